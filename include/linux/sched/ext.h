@@ -21,6 +21,9 @@ enum scx_consts {
 	SCX_EXIT_REASON_LEN	= 128,
 	SCX_EXIT_BT_LEN		= 64,
 	SCX_EXIT_MSG_LEN	= 1024,
+	SCX_TASK_DATA_U64S	= 4,	/* see sched_ext_entity->sched_data */
+	SCX_NR_AFFN_CLASSES	= 64,	/* see sched_ext_entity->affn_class */
+	SCX_AFFN_CLASS_NONE	= U32_MAX,
 
 	SCX_SLICE_DFL		= 20 * NSEC_PER_MSEC,
 	SCX_SLICE_INF		= U64_MAX,	/* infinite, implies nohz */
@@ -51,10 +54,24 @@ enum scx_dsq_id_flags {
 	SCX_DSQ_INVALID		= SCX_DSQ_FLAG_BUILTIN | 0,
 	SCX_DSQ_GLOBAL		= SCX_DSQ_FLAG_BUILTIN | 1,
 	SCX_DSQ_LOCAL		= SCX_DSQ_FLAG_BUILTIN | 2,
+	SCX_DSQ_CGROUP		= SCX_DSQ_FLAG_BUILTIN | 3,	/* see %SCX_OPS_CGROUP_DSQ */
 	SCX_DSQ_LOCAL_ON	= SCX_DSQ_FLAG_BUILTIN | SCX_DSQ_FLAG_LOCAL_ON,
 	SCX_DSQ_LOCAL_CPU_MASK	= 0xffffffffLLU,
 };
 
+/* DSQ creation flags, see scx_bpf_create_dsq_flags() */
+enum scx_dsq_flags {
+	/*
+	 * Order the priority queue by p->scx.dsq_deadline and break ties with
+	 * p->scx.dsq_vtime, both compared with time_before64(). Useful for
+	 * earliest-deadline-first scheduling or lexicographic (class, key)
+	 * ordering without packing both keys into the vtime.
+	 */
+	SCX_DSQ_ORDER_EDF	= 1LLU << 0,
+
+	SCX_DSQ_ALL_FLAGS	= SCX_DSQ_ORDER_EDF,
+};
+
 enum scx_exit_type {
 	SCX_EXIT_NONE,
 	SCX_EXIT_DONE,
@@ -112,6 +129,46 @@ enum scx_ops_flags {
 	 */
 	SCX_OPS_ENQ_EXITING	= 1LLU << 2,
 
+	/*
+	 * When consuming a DSQ, scx_bpf_consume() and the built-in global DSQ
+	 * consumption pick the first task which can run on the consuming CPU.
+	 * If this flag is set, a task which last ran on a CPU in a different
+	 * LLC less than sysctl_sched_migration_cost ago is skipped over if
+	 * there's a cache-cold task further down the DSQ which can run on the
+	 * consuming CPU. If all eligible tasks are hot, the first one is taken
+	 * as usual. See scx_bpf_task_cache_hot().
+	 */
+	SCX_OPS_CONSUME_COLD_FIRST = 1LLU << 3,
+
+	/*
+	 * When the core places a task on a DSQ by itself without going through
+	 * ops.enqueue() - e.g. exiting tasks, offline CPUs, %SCX_ENQ_LAST,
+	 * overload bypass or when ops.enqueue() isn't implemented - the task's
+	 * slice is set to ops.slice_dfl_ns. If this flag is set, the slice is
+	 * instead scaled down by the number of runnable tasks on the CPU like
+	 * CFS's sched_slice(), but not below 750us.
+	 */
+	SCX_OPS_ADAPTIVE_SLICE	= 1LLU << 4,
+
+	/*
+	 * If set, whenever a task is dispatched to a non-local DSQ, an idle
+	 * CPU which the task can run on is picked and kicked so that it goes
+	 * through ops.dispatch() and gets a chance to consume the DSQ. This
+	 * papers over BPF schedulers which forget to kick an idle CPU after
+	 * queueing a task. Requires the built-in idle tracking.
+	 */
+	SCX_OPS_KICK_IDLE_ON_ENQ = 1LLU << 5,
+
+	/*
+	 * If set, the core attaches a DSQ to each cgroup with the CPU
+	 * controller enabled. The DSQ is created before ops.cgroup_init() and
+	 * destroyed after ops.cgroup_exit(). Dispatching to %SCX_DSQ_CGROUP
+	 * queues the task on its cgroup's DSQ, and scx_bpf_consume_cgroup()
+	 * consumes from a cgroup's DSQ. Both reach the DSQ through the cgroup
+	 * without a DSQ ID lookup. Requires %CONFIG_EXT_GROUP_SCHED.
+	 */
+	SCX_OPS_CGROUP_DSQ	= 1LLU << 6,
+
 	/*
 	 * CPU cgroup knob enable flags
 	 */
@@ -120,6 +177,10 @@ enum scx_ops_flags {
 	SCX_OPS_ALL_FLAGS	= SCX_OPS_KEEP_BUILTIN_IDLE |
 				  SCX_OPS_ENQ_LAST |
 				  SCX_OPS_ENQ_EXITING |
+				  SCX_OPS_CONSUME_COLD_FIRST |
+				  SCX_OPS_ADAPTIVE_SLICE |
+				  SCX_OPS_KICK_IDLE_ON_ENQ |
+				  SCX_OPS_CGROUP_DSQ |
 				  SCX_OPS_CGROUP_KNOB_WEIGHT,
 };
 
@@ -163,6 +224,26 @@ struct scx_cpu_release_args {
 	struct task_struct *task;
 };
 
+/* output container for scx_bpf_dsq_peek() */
+struct scx_dsq_peek_info {
+	/* p->scx.dsq_vtime and p->scx.dsq_deadline of the head task */
+	u64			dsq_vtime;
+	u64			dsq_deadline;
+
+	/* when the head task became runnable, in jiffies */
+	u64			runnable_at;
+
+	/*
+	 * Enqueue sequence number of the head task on the DSQ, to be passed
+	 * to scx_bpf_consume_if_head(). Unlike the pid, it changes if the
+	 * task leaves and is queued back on the DSQ.
+	 */
+	u64			seq;
+
+	/* pid of the head task */
+	s32			pid;
+};
+
 /**
  * struct sched_ext_ops - Operation table for BPF scheduler implementation
  *
@@ -558,6 +639,16 @@ struct sched_ext_ops {
 	 */
 	u64 flags;
 
+	/**
+	 * slice_dfl_ns - Slice for tasks placed by the core
+	 *
+	 * The slice in nsecs given to tasks which the core queues by itself
+	 * without going through ops.enqueue(). See %SCX_OPS_ADAPTIVE_SLICE.
+	 *
+	 * Defaults to %SCX_SLICE_DFL.
+	 */
+	u64 slice_dfl_ns;
+
 	/**
 	 * timeout_ms - The maximum amount of time, in milliseconds, that a
 	 * runnable task should be able to wait before being scheduled. The
@@ -567,6 +658,51 @@ struct sched_ext_ops {
 	 */
 	u32 timeout_ms;
 
+	/**
+	 * bypass_age_ms - Runnable wait time which triggers overload bypass
+	 *
+	 * If non-zero, when a runnable task has been waiting for longer than
+	 * this many milliseconds, the BPF scheduler is considered overloaded
+	 * and the core temporarily bypasses it instead of waiting for the
+	 * watchdog to abort it. While bypassing, ops.enqueue() and
+	 * ops.dispatch() aren't called and tasks are scheduled in FIFO order
+	 * from the local DSQs with @slice_dfl_ns. ops.select_cpu() is
+	 * replaced with the built-in idle CPU selection. Control is handed back
+	 * to the BPF scheduler after the same amount of time and tasks which
+	 * were queued on the BPF side get another @bypass_age_ms to be
+	 * scheduled before bypass can trigger again.
+	 *
+	 * As ops.dispatch() isn't called, tasks which are already held on the
+	 * BPF side or queued on custom DSQs don't make progress while
+	 * bypassing. Bypass only keeps the newly runnable tasks moving. Leaving
+	 * it is purely time based.
+	 *
+	 * Must be shorter than half of @timeout_ms, or of the default timeout
+	 * if @timeout_ms is zero. 0 disables overload bypass.
+	 */
+	u32 bypass_age_ms;
+
+	/**
+	 * bypass_nr_dsp_exhausts - Dispatch loop exhaustions triggering bypass
+	 *
+	 * If non-zero and @bypass_age_ms is set, overload bypass is also
+	 * triggered when ops.dispatch() fails to produce a runnable task for
+	 * %SCX_DSP_MAX_LOOPS consecutive iterations this many times within
+	 * @bypass_age_ms / 2.
+	 */
+	u32 bypass_nr_dsp_exhausts;
+
+	/**
+	 * cpu_ctx_size - Size of the per-CPU context area
+	 *
+	 * If non-zero, the core allocates a zeroed area of this many bytes for
+	 * each possible CPU before ops.init() and frees it after ops.exit().
+	 * The BPF scheduler can access it with scx_bpf_cpu_ctx(), which is a
+	 * lot cheaper than looking up a per-CPU map. Can't be larger than
+	 * %PAGE_SIZE.
+	 */
+	u32 cpu_ctx_size;
+
 	/**
 	 * name - BPF scheduler's name
 	 *
@@ -586,7 +722,12 @@ struct scx_dispatch_q {
 	struct list_head	fifo;	/* processed in dispatching order */
 	struct rb_root_cached	priq;	/* processed in p->scx.dsq_vtime order */
 	u32			nr;
+	u32			max_nr;	/* high watermark, 0 if unlimited */
+	u64			seq;	/* bumped on each enqueue, never 0 */
 	u64			id;
+	u64			flags;	/* SCX_DSQ_ORDER_* */
+	u64			nr_idle_pending;	/* see dispatch_enqueue() */
+	u64			idle_pending_nsecs;
 	struct rhash_head	hash_node;
 	struct llist_node	free_node;
 	struct rcu_head		rcu;
@@ -641,7 +782,7 @@ struct sched_ext_entity {
 	struct scx_dispatch_q	*dsq;
 	struct {
 		struct list_head	fifo;	/* dispatch order */
-		struct rb_node		priq;	/* p->scx.dsq_vtime order */
+		struct rb_node		priq;	/* p->scx.dsq_[deadline,vtime] order */
 	} dsq_node;
 	struct list_head	watchdog_node;
 	u32			flags;		/* protected by rq lock */
@@ -649,9 +790,21 @@ struct sched_ext_entity {
 	s32			sticky_cpu;
 	s32			holding_cpu;
 	u32			kf_mask;	/* see scx_kf_mask above */
+
+	/*
+	 * Tasks with identical effective cpumasks share the same affinity
+	 * class ID which is maintained by the core whenever @p->cpus_ptr
+	 * changes. The BPF scheduler can read it directly to bucket tasks by
+	 * affinity and use scx_bpf_get_affn_class_cpumask() to look up the
+	 * cpumask. %SCX_AFFN_CLASS_NONE if @p is pinned to a single CPU or
+	 * there are more than %SCX_NR_AFFN_CLASSES distinct cpumasks.
+	 */
+	u32			affn_class;
 	struct task_struct	*kf_tasks[2];	/* see SCX_CALL_OP_TASK() */
 	atomic64_t		ops_state;
 	unsigned long		runnable_at;
+	u64			idle_pending_at; /* see dispatch_enqueue() */
+	u64			dsq_seq;	/* @dsq->seq when queued on @dsq */
 #ifdef CONFIG_SCHED_CORE
 	u64			core_sched_at;	/* see scx_prio_less() */
 #endif
@@ -679,6 +832,13 @@ struct sched_ext_entity {
 	 */
 	u64			dsq_vtime;
 
+	/*
+	 * Primary ordering key on the priority queue of a DSQ created with
+	 * %SCX_DSQ_ORDER_EDF, @dsq_vtime breaks ties. Usually set through
+	 * scx_bpf_dispatch_edf(). Ignored by other DSQs.
+	 */
+	u64			dsq_deadline;
+
 	/*
 	 * If set, reject future sched_setscheduler(2) calls updating the policy
 	 * to %SCHED_EXT with -%EACCES.
@@ -691,6 +851,14 @@ struct sched_ext_entity {
 	 */
 	bool			disallow;	/* reject switching into SCX */
 
+	/*
+	 * Scratch area for the BPF scheduler's per-task context, which can be
+	 * accessed directly through @p->scx without a task storage or map
+	 * lookup. Cleared before ops.prep_enable(). As the verifier treats the
+	 * area as scalars, it can't hold kptrs or other pointers.
+	 */
+	u64			sched_data[SCX_TASK_DATA_U64S];
+
 	/* cold fields */
 	struct list_head	tasks_node;
 #ifdef CONFIG_EXT_GROUP_SCHED
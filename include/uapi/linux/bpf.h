@@ -1275,6 +1275,11 @@ enum {
 
 /* Get path from provided FD in BPF_OBJ_PIN/BPF_OBJ_GET commands */
 	BPF_F_PATH_FD		= (1U << 14),
+
+/* Lockless multi-producer multi-consumer BPF_MAP_TYPE_QUEUE with relaxed
+ * semantics, see kernel/bpf/queue_stack_maps.c
+ */
+	BPF_F_QUEUE_MPMC	= (1U << 15),
 };
 
 /* Flags for BPF_PROG_QUERY. */
@@ -7194,4 +7199,12 @@ struct bpf_iter_num {
 	__u64 __opaque[1];
 } __attribute__((aligned(8)));
 
+/* BPF cpumask iterator state */
+struct bpf_iter_cpumask {
+	/* opaque iterator state; having __u64 here allows to preserve correct
+	 * alignment requirements in vmlinux.h, generated from BTF
+	 */
+	__u64 __opaque[5];
+} __attribute__((aligned(8)));
+
 #endif /* _UAPI__LINUX_BPF_H__ */
@@ -331,6 +331,10 @@ static long array_map_update_elem(struct bpf_map *map, void *key, void *value,
 		return -EINVAL;
 
 	if (array->map.map_type == BPF_MAP_TYPE_PERCPU_ARRAY) {
+		/* per-CPU values aren't copied under their locks */
+		if (unlikely(map_flags & BPF_F_LOCK))
+			return -EINVAL;
+
 		val = this_cpu_ptr(array->pptrs[index & array->index_mask]);
 		copy_map_value(map, val, value);
 		bpf_obj_free_fields(array->map.record, val);
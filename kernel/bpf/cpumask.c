@@ -398,6 +398,119 @@ __bpf_kfunc u32 bpf_cpumask_any_and(const struct cpumask *src1, const struct cpu
 	return cpumask_any_and(src1, src2);
 }
 
+/*
+ * Masks of up to this many CPUs are copied into the iterator itself. Larger
+ * ones are copied into a struct bpf_cpumask allocated from bpf_cpumask_ma.
+ */
+#define BPF_ITER_CPUMASK_INLINE_CPUS	256
+
+struct bpf_iter_cpumask_kern {
+	union {
+		unsigned long bits[BITS_TO_LONGS(BPF_ITER_CPUMASK_INLINE_CPUS)];
+		struct bpf_cpumask *mask;
+	};
+	int cpu;
+} __aligned(8);
+
+static bool bpf_iter_cpumask_inline(void)
+{
+	return nr_cpu_ids <= BPF_ITER_CPUMASK_INLINE_CPUS;
+}
+
+/**
+ * bpf_iter_cpumask_new() - Initialize an iterator over the set CPUs of a
+ *			    cpumask.
+ * @it: The iterator to initialize.
+ * @mask: The cpumask to iterate over.
+ *
+ * Unlike looping over all CPUs and testing each with bpf_cpumask_test_cpu(),
+ * the cost of iterating is proportional to the number of set CPUs. @mask is
+ * copied into memory owned by the iterator, so CPUs which are set or cleared
+ * after this call don't affect the iteration, and @mask may be released
+ * before the iterator is destroyed. On systems with up to 256 possible CPUs,
+ * the copy is stored in the iterator and no memory is allocated.
+ *
+ * A struct bpf_cpumask pointer may be safely passed to @mask.
+ *
+ * Return:
+ * * 0 - Success.
+ * * -ENOMEM - Failed to allocate the copy. The iterator is empty. Can only
+ *   happen with more than 256 possible CPUs.
+ */
+__bpf_kfunc int bpf_iter_cpumask_new(struct bpf_iter_cpumask *it,
+				     const struct cpumask *mask)
+{
+	struct bpf_iter_cpumask_kern *s = (void *)it;
+
+	BUILD_BUG_ON(sizeof(struct bpf_iter_cpumask_kern) != sizeof(struct bpf_iter_cpumask));
+	BUILD_BUG_ON(__alignof__(struct bpf_iter_cpumask_kern) !=
+		     __alignof__(struct bpf_iter_cpumask));
+
+	BTF_TYPE_EMIT(struct bpf_iter_cpumask);
+
+	s->cpu = -1;
+
+	/*
+	 * @mask is only guaranteed to stay valid for the duration of this call.
+	 * e.g. sleepable programs may release it while iterating.
+	 */
+	if (bpf_iter_cpumask_inline()) {
+		bitmap_copy(s->bits, cpumask_bits(mask), nr_cpu_ids);
+		return 0;
+	}
+
+	s->mask = bpf_mem_cache_alloc(&bpf_cpumask_ma);
+	if (!s->mask)
+		return -ENOMEM;
+
+	cpumask_copy(&s->mask->cpumask, mask);
+	return 0;
+}
+
+/**
+ * bpf_iter_cpumask_next() - Advance a cpumask iterator to the next set CPU.
+ * @it: The iterator to advance.
+ *
+ * Return:
+ * * A pointer to the next set CPU.
+ * * NULL if there are no more set CPUs.
+ */
+__bpf_kfunc int *bpf_iter_cpumask_next(struct bpf_iter_cpumask *it)
+{
+	struct bpf_iter_cpumask_kern *s = (void *)it;
+
+	if (s->cpu >= (int)nr_cpu_ids)
+		return NULL;
+
+	if (bpf_iter_cpumask_inline())
+		s->cpu = find_next_bit(s->bits, nr_cpu_ids, s->cpu + 1);
+	else if (s->mask)
+		s->cpu = cpumask_next(s->cpu, &s->mask->cpumask);
+	else
+		return NULL;
+
+	if (s->cpu >= nr_cpu_ids)
+		return NULL;
+
+	return &s->cpu;
+}
+
+/**
+ * bpf_iter_cpumask_destroy() - Destroy a cpumask iterator.
+ * @it: The iterator to destroy.
+ */
+__bpf_kfunc void bpf_iter_cpumask_destroy(struct bpf_iter_cpumask *it)
+{
+	struct bpf_iter_cpumask_kern *s = (void *)it;
+
+	if (bpf_iter_cpumask_inline())
+		return;
+
+	if (s->mask)
+		bpf_mem_cache_free(&bpf_cpumask_ma, s->mask);
+	s->mask = NULL;
+}
+
 __diag_pop();
 
 BTF_SET8_START(cpumask_kfunc_btf_ids)
@@ -424,6 +537,9 @@ BTF_ID_FLAGS(func, bpf_cpumask_full, KF_RCU)
 BTF_ID_FLAGS(func, bpf_cpumask_copy, KF_RCU)
 BTF_ID_FLAGS(func, bpf_cpumask_any, KF_RCU)
 BTF_ID_FLAGS(func, bpf_cpumask_any_and, KF_RCU)
+BTF_ID_FLAGS(func, bpf_iter_cpumask_new, KF_ITER_NEW | KF_RCU)
+BTF_ID_FLAGS(func, bpf_iter_cpumask_next, KF_ITER_NEXT | KF_RET_NULL)
+BTF_ID_FLAGS(func, bpf_iter_cpumask_destroy, KF_ITER_DESTROY)
 BTF_SET8_END(cpumask_kfunc_btf_ids)
 
 static const struct btf_kfunc_id_set cpumask_kfunc_set = {
@@ -7,20 +7,32 @@
 #include <linux/bpf.h>
 #include <linux/list.h>
 #include <linux/slab.h>
+#include <linux/log2.h>
 #include <linux/capability.h>
 #include <linux/btf_ids.h>
 #include "percpu_freelist.h"
 
 #define QUEUE_STACK_CREATE_FLAG_MASK \
-	(BPF_F_NUMA_NODE | BPF_F_ACCESS_MASK)
+	(BPF_F_NUMA_NODE | BPF_F_ACCESS_MASK | BPF_F_QUEUE_MPMC)
 
 struct bpf_queue_stack {
 	struct bpf_map map;
 	raw_spinlock_t lock;
 	u32 head, tail;
-	u32 size; /* max_entries + 1 */
+	u32 size; /* max_entries + 1, or the number of cells if MPMC */
 
-	char elements[] __aligned(8);
+	/* BPF_F_QUEUE_MPMC, see queue_mpmc_cell() */
+	u32 mask; /* number of cells - 1 */
+	u32 cell_size;
+	u32 enq_pos ____cacheline_aligned_in_smp;
+	u32 deq_pos ____cacheline_aligned_in_smp;
+
+	char elements[] ____cacheline_aligned_in_smp;
+};
+
+struct queue_mpmc_cell {
+	u32 seq;
+	char value[] __aligned(8);
 };
 
 static struct bpf_queue_stack *bpf_queue_stack(struct bpf_map *map)
@@ -62,6 +74,14 @@ static int queue_stack_map_alloc_check(union bpf_attr *attr)
 		 */
 		return -E2BIG;
 
+	if (attr->map_flags & BPF_F_QUEUE_MPMC) {
+		if (attr->map_type != BPF_MAP_TYPE_QUEUE)
+			return -EINVAL;
+		/* the cell sequence numbers are compared as s32 */
+		if (attr->max_entries > 1U << 30)
+			return -E2BIG;
+	}
+
 	return 0;
 }
 
@@ -70,9 +90,17 @@ static struct bpf_map *queue_stack_map_alloc(union bpf_attr *attr)
 	int numa_node = bpf_map_attr_numa_node(attr);
 	struct bpf_queue_stack *qs;
 	u64 size, queue_size;
-
-	size = (u64) attr->max_entries + 1;
-	queue_size = sizeof(*qs) + size * attr->value_size;
+	u32 cell_size = 0;
+
+	if (attr->map_flags & BPF_F_QUEUE_MPMC) {
+		size = roundup_pow_of_two(attr->max_entries);
+		cell_size = round_up(sizeof(struct queue_mpmc_cell) +
+				     attr->value_size, 8);
+		queue_size = sizeof(*qs) + size * cell_size;
+	} else {
+		size = (u64) attr->max_entries + 1;
+		queue_size = sizeof(*qs) + size * attr->value_size;
+	}
 
 	qs = bpf_map_area_alloc(queue_size, numa_node);
 	if (!qs)
@@ -84,6 +112,19 @@ static struct bpf_map *queue_stack_map_alloc(union bpf_attr *attr)
 
 	raw_spin_lock_init(&qs->lock);
 
+	if (attr->map_flags & BPF_F_QUEUE_MPMC) {
+		u32 i;
+
+		qs->mask = size - 1;
+		qs->cell_size = cell_size;
+		for (i = 0; i < size; i++) {
+			struct queue_mpmc_cell *cell =
+				(void *)&qs->elements[i * cell_size];
+
+			cell->seq = i;
+		}
+	}
+
 	return &qs->map;
 }
 
@@ -95,6 +136,103 @@ static void queue_stack_map_free(struct bpf_map *map)
 	bpf_map_area_free(qs);
 }
 
+/*
+ * BPF_F_QUEUE_MPMC queues are bounded multi-producer multi-consumer rings
+ * which don't take qs->lock. Every CPU pushing to or popping from a regular
+ * queue serializes on the lock, which becomes the bottleneck when e.g. a
+ * sched_ext scheduler enqueues and dispatches from all CPUs through a shared
+ * queue.
+ *
+ * Each cell carries a sequence number which tells whose turn it is. A cell at
+ * position @pos is free for the producer when seq == @pos and holds a value
+ * for the consumer when seq == @pos + 1. Producers and consumers claim
+ * positions by advancing qs->enq_pos and qs->deq_pos with cmpxchg, copy the
+ * value and then hand the cell over by releasing the next sequence number.
+ * As nothing spins waiting for another CPU, the operations are safe from any
+ * context including NMI.
+ *
+ * The semantics are relaxed compared to regular queues:
+ *
+ * - The capacity is max_entries rounded up to the next power of two.
+ *
+ * - Values are popped in the order their pushes claimed positions. A pop or
+ *   peek may fail with -ENOENT while a push which claimed an earlier position
+ *   is still copying its value in, even if later pushes have completed.
+ *   Likewise, a push may fail with -E2BIG while a pop is still copying out.
+ *
+ * - A peeked value may be popped by another CPU before the peek returns.
+ *
+ * - BPF_EXIST, which overwrites the oldest value when full, isn't supported.
+ */
+static struct queue_mpmc_cell *queue_mpmc_cell(struct bpf_queue_stack *qs,
+					       u32 pos)
+{
+	return (void *)&qs->elements[(pos & qs->mask) * qs->cell_size];
+}
+
+static long queue_mpmc_push(struct bpf_queue_stack *qs, void *value)
+{
+	struct queue_mpmc_cell *cell;
+	u32 pos, seq;
+
+	pos = READ_ONCE(qs->enq_pos);
+	for (;;) {
+		cell = queue_mpmc_cell(qs, pos);
+		seq = smp_load_acquire(&cell->seq);
+
+		if (seq == pos) {
+			if (try_cmpxchg(&qs->enq_pos, &pos, pos + 1))
+				break;
+		} else if ((s32)(seq - pos) < 0) {
+			/* the value from the previous lap hasn't been popped */
+			return -E2BIG;
+		} else {
+			pos = READ_ONCE(qs->enq_pos);
+		}
+	}
+
+	memcpy(cell->value, value, qs->map.value_size);
+	smp_store_release(&cell->seq, pos + 1);
+	return 0;
+}
+
+static long queue_mpmc_get(struct bpf_queue_stack *qs, void *value,
+			   bool delete)
+{
+	struct queue_mpmc_cell *cell;
+	u32 pos, seq;
+
+	pos = READ_ONCE(qs->deq_pos);
+	for (;;) {
+		cell = queue_mpmc_cell(qs, pos);
+		seq = smp_load_acquire(&cell->seq);
+
+		if (seq == pos + 1) {
+			if (!delete) {
+				/* make sure the cell wasn't recycled under us */
+				memcpy(value, cell->value, qs->map.value_size);
+				smp_rmb();
+				if (READ_ONCE(cell->seq) == seq)
+					return 0;
+				pos = READ_ONCE(qs->deq_pos);
+				continue;
+			}
+			if (try_cmpxchg(&qs->deq_pos, &pos, pos + 1))
+				break;
+		} else if ((s32)(seq - (pos + 1)) < 0) {
+			/* empty or the push to @pos is still in progress */
+			memset(value, 0, qs->map.value_size);
+			return -ENOENT;
+		} else {
+			pos = READ_ONCE(qs->deq_pos);
+		}
+	}
+
+	memcpy(value, cell->value, qs->map.value_size);
+	smp_store_release(&cell->seq, pos + qs->mask + 1);
+	return 0;
+}
+
 static long __queue_map_get(struct bpf_map *map, void *value, bool delete)
 {
 	struct bpf_queue_stack *qs = bpf_queue_stack(map);
@@ -102,6 +240,9 @@ static long __queue_map_get(struct bpf_map *map, void *value, bool delete)
 	int err = 0;
 	void *ptr;
 
+	if (map->map_flags & BPF_F_QUEUE_MPMC)
+		return queue_mpmc_get(qs, value, delete);
+
 	raw_spin_lock_irqsave(&qs->lock, flags);
 
 	if (queue_stack_map_is_empty(qs)) {
@@ -197,6 +338,12 @@ static long queue_stack_map_push_elem(struct bpf_map *map, void *value,
 	if (flags & BPF_NOEXIST || flags > BPF_EXIST)
 		return -EINVAL;
 
+	if (map->map_flags & BPF_F_QUEUE_MPMC) {
+		if (replace)
+			return -EINVAL;
+		return queue_mpmc_push(qs, value);
+	}
+
 	raw_spin_lock_irqsave(&qs->lock, irq_flags);
 
 	if (queue_stack_map_is_full(qs)) {
@@ -248,9 +395,14 @@ static int queue_stack_map_get_next_key(struct bpf_map *map, void *key,
 
 static u64 queue_stack_map_mem_usage(const struct bpf_map *map)
 {
+	const struct bpf_queue_stack *qs =
+		container_of(map, struct bpf_queue_stack, map);
 	u64 usage = sizeof(struct bpf_queue_stack);
 
-	usage += ((u64)map->max_entries + 1) * map->value_size;
+	if (map->map_flags & BPF_F_QUEUE_MPMC)
+		usage += (u64)qs->size * qs->cell_size;
+	else
+		usage += ((u64)map->max_entries + 1) * map->value_size;
 	return usage;
 }
 
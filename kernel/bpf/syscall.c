@@ -1056,6 +1056,7 @@ static int map_check_btf(struct bpf_map *map, const struct btf *btf,
 			case BPF_SPIN_LOCK:
 				if (map->map_type != BPF_MAP_TYPE_HASH &&
 				    map->map_type != BPF_MAP_TYPE_ARRAY &&
+				    map->map_type != BPF_MAP_TYPE_PERCPU_ARRAY &&
 				    map->map_type != BPF_MAP_TYPE_CGROUP_STORAGE &&
 				    map->map_type != BPF_MAP_TYPE_SK_STORAGE &&
 				    map->map_type != BPF_MAP_TYPE_INODE_STORAGE &&
@@ -1094,7 +1095,8 @@ static int map_check_btf(struct bpf_map *map, const struct btf *btf,
 			case BPF_RB_ROOT:
 				if (map->map_type != BPF_MAP_TYPE_HASH &&
 				    map->map_type != BPF_MAP_TYPE_LRU_HASH &&
-				    map->map_type != BPF_MAP_TYPE_ARRAY) {
+				    map->map_type != BPF_MAP_TYPE_ARRAY &&
+				    map->map_type != BPF_MAP_TYPE_PERCPU_ARRAY) {
 					ret = -EOPNOTSUPP;
 					goto free_map_tab;
 				}
@@ -1380,8 +1382,10 @@ static int map_lookup_elem(union bpf_attr *attr)
 		goto err_put;
 	}
 
+	/* per-CPU values aren't copied under their locks */
 	if ((attr->flags & BPF_F_LOCK) &&
-	    !btf_record_has_field(map->record, BPF_SPIN_LOCK)) {
+	    (!btf_record_has_field(map->record, BPF_SPIN_LOCK) ||
+	     map->map_type == BPF_MAP_TYPE_PERCPU_ARRAY)) {
 		err = -EINVAL;
 		goto err_put;
 	}
@@ -1733,7 +1737,8 @@ int generic_map_lookup_batch(struct bpf_map *map,
 		return -EINVAL;
 
 	if ((attr->batch.elem_flags & BPF_F_LOCK) &&
-	    !btf_record_has_field(map->record, BPF_SPIN_LOCK))
+	    (!btf_record_has_field(map->record, BPF_SPIN_LOCK) ||
+	     map->map_type == BPF_MAP_TYPE_PERCPU_ARRAY))
 		return -EINVAL;
 
 	value_size = bpf_map_value_size(map);
@@ -379,6 +379,10 @@ static __init int sched_init_debug(void)
 
 #ifdef CONFIG_SCHED_CLASS_EXT
 	debugfs_create_file("ext", 0444, debugfs_sched, NULL, &sched_ext_fops);
+	debugfs_create_file("ext_op_stats", 0644, debugfs_sched, NULL,
+			    &sched_ext_op_stats_fops);
+	debugfs_create_file("ext_idle_pending_stats", 0644, debugfs_sched, NULL,
+			    &sched_ext_idle_pending_stats_fops);
 #endif
 	return 0;
 }
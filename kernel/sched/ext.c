@@ -10,9 +10,11 @@
 
 enum scx_internal_consts {
 	SCX_NR_ONLINE_OPS	= SCX_OP_IDX(init),
+	SCX_NR_OPS		= SCX_OP_IDX(dispatch_max_batch),
 	SCX_DSP_DFL_MAX_BATCH	= 32,
 	SCX_DSP_MAX_LOOPS	= 32,
 	SCX_WATCHDOG_MAX_TIMEOUT = 30 * HZ,
+	SCX_SLICE_ADAPTIVE_MIN	= 750 * NSEC_PER_USEC,	/* CFS' default min granularity */
 };
 
 enum scx_ops_enable_state {
@@ -83,8 +85,15 @@ DEFINE_STATIC_KEY_FALSE(__scx_switched_all);
 static struct sched_ext_ops scx_ops;
 static bool scx_warned_zero_slice;
 
+/* see sched_ext_ops.slice_dfl_ns */
+static u64 scx_slice_dfl = SCX_SLICE_DFL;
+
 static DEFINE_STATIC_KEY_FALSE(scx_ops_enq_last);
 static DEFINE_STATIC_KEY_FALSE(scx_ops_enq_exiting);
+static DEFINE_STATIC_KEY_FALSE(scx_ops_consume_cold_first);
+static DEFINE_STATIC_KEY_FALSE(scx_ops_adaptive_slice);
+static DEFINE_STATIC_KEY_FALSE(scx_ops_kick_idle_on_enq);
+static DEFINE_STATIC_KEY_FALSE(scx_ops_cgroup_dsq);
 DEFINE_STATIC_KEY_FALSE(scx_ops_cpu_preempt);
 static DEFINE_STATIC_KEY_FALSE(scx_builtin_idle_enabled);
 
@@ -96,6 +105,16 @@ static struct scx_exit_info scx_exit_info;
 
 static atomic64_t scx_nr_rejected = ATOMIC64_INIT(0);
 
+/*
+ * Interned effective cpumasks, see sched_ext_entity->affn_class. Entries are
+ * only appended and stay unchanged until the table is reset on the next
+ * scx_ops_enable(), which allows looking them up without locking.
+ */
+static DEFINE_RAW_SPINLOCK(scx_affn_lock);
+static cpumask_var_t scx_affn_masks[SCX_NR_AFFN_CLASSES];
+static u32 scx_affn_hashes[SCX_NR_AFFN_CLASSES];
+static u32 scx_nr_affn_classes;
+
 /*
  * The maximum amount of time in jiffies that a task may be runnable without
  * being scheduled on a CPU. If this timeout is exceeded, it will trigger
@@ -113,6 +132,23 @@ unsigned long scx_watchdog_timestamp = INITIAL_JIFFIES;
 
 static struct delayed_work scx_watchdog_work;
 
+/*
+ * Overload bypass, see sched_ext_ops.bypass_age_ms. While
+ * @scx_ops_bypassing is set, the core doesn't call ops.enqueue() and
+ * ops.dispatch() and schedules tasks from the local DSQs. The state is flipped
+ * from scheduling paths and thus can't be a static key. @scx_ops_auto_bypass
+ * keeps the test out of the hot paths if bypass isn't enabled.
+ */
+static DEFINE_STATIC_KEY_FALSE(scx_ops_auto_bypass);
+static atomic_t scx_ops_bypassing = ATOMIC_INIT(0);
+static unsigned long scx_bypass_age;		/* in jiffies */
+static u32 scx_bypass_nr_dsp_exhausts;
+static unsigned long scx_bypass_entered_at;
+static unsigned long scx_bypass_left_at;
+static atomic_t scx_bypass_dsp_exhausts = ATOMIC_INIT(0);
+static atomic64_t scx_nr_bypasses = ATOMIC64_INIT(0);
+static struct delayed_work scx_bypass_work;
+
 /* idle tracking */
 #ifdef CONFIG_SMP
 #ifdef CONFIG_CPUMASK_OFFSTACK
@@ -128,6 +164,23 @@ static struct {
 
 #endif	/* CONFIG_SMP */
 
+/*
+ * Number and total duration of the waits of tasks on non-local DSQs which were
+ * queued while an idle CPU they could run on was available, and the number of
+ * idle CPUs kicked by %SCX_OPS_KICK_IDLE_ON_ENQ. The waits are accounted both
+ * per DSQ, see scx_dispatch_q->nr_idle_pending, and in total which is reported
+ * in /sys/kernel/debug/sched/ext. Wait tracking is enabled by writing 1 to
+ * /sys/kernel/debug/sched/ext_idle_pending_stats.
+ */
+struct scx_idle_pending_stat {
+	u64			nr;
+	u64			nsecs;
+};
+
+static DEFINE_STATIC_KEY_FALSE(scx_idle_pending_enabled);
+static DEFINE_PER_CPU(struct scx_idle_pending_stat, scx_idle_pending_stats);
+static atomic64_t scx_nr_idle_kicks = ATOMIC64_INIT(0);
+
 /* for %SCX_KICK_WAIT */
 static u64 __percpu *scx_kick_cpus_pnt_seqs;
 
@@ -175,6 +228,7 @@ static DEFINE_PER_CPU(struct scx_dsp_ctx, scx_dsp_ctx);
 void scx_bpf_dispatch(struct task_struct *p, u64 dsq_id, u64 slice,
 		      u64 enq_flags);
 void scx_bpf_kick_cpu(s32 cpu, u64 flags);
+static s32 scx_pick_idle_cpu(const struct cpumask *cpus_allowed, u64 flags);
 
 struct scx_task_iter {
 	struct sched_ext_entity		cursor;
@@ -185,6 +239,41 @@ struct scx_task_iter {
 
 #define SCX_HAS_OP(op)	static_branch_likely(&scx_has_op[SCX_OP_IDX(op)])
 
+/*
+ * Per-op invocation counts and execution times. Enabled by writing 1 to
+ * /sys/kernel/debug/sched/ext_op_stats and reported in
+ * /sys/kernel/debug/sched/ext. When disabled, the overhead is a static branch
+ * per op invocation.
+ */
+struct scx_op_stat {
+	u64			nr;
+	u64			nsecs;
+};
+
+static DEFINE_STATIC_KEY_FALSE(scx_op_stats_enabled);
+static DEFINE_PER_CPU(struct scx_op_stat, scx_op_stats[SCX_NR_OPS]);
+
+static __always_inline u64 scx_op_stat_start(void)
+{
+	if (static_branch_unlikely(&scx_op_stats_enabled))
+		return local_clock();
+	return 0;
+}
+
+static __always_inline void scx_op_stat_end(int idx, u64 start)
+{
+	if (static_branch_unlikely(&scx_op_stats_enabled) && start) {
+		/*
+		 * Sleepable ops may migrate and local_clock() isn't
+		 * synchronized across CPUs. Clamp if it went backwards.
+		 */
+		s64 delta = local_clock() - start;
+
+		this_cpu_inc(scx_op_stats[idx].nr);
+		this_cpu_add(scx_op_stats[idx].nsecs, max_t(s64, delta, 0));
+	}
+}
+
 /* if the highest set bit is N, return a mask with bits [N+1, 31] set */
 static u32 higher_bits(u32 flags)
 {
@@ -222,6 +311,7 @@ static void scx_kf_disallow(u32 mask)
 
 #define SCX_CALL_OP(mask, op, args...)						\
 do {										\
+	u64 __op_start = scx_op_stat_start();					\
 	if (mask) {								\
 		scx_kf_allow(mask);						\
 		scx_ops.op(args);						\
@@ -229,11 +319,13 @@ do {										\
 	} else {								\
 		scx_ops.op(args);						\
 	}									\
+	scx_op_stat_end(SCX_OP_IDX(op), __op_start);				\
 } while (0)
 
 #define SCX_CALL_OP_RET(mask, op, args...)					\
 ({										\
 	__typeof__(scx_ops.op(args)) __ret;					\
+	u64 __op_start = scx_op_stat_start();					\
 	if (mask) {								\
 		scx_kf_allow(mask);						\
 		__ret = scx_ops.op(args);					\
@@ -241,6 +333,7 @@ do {										\
 	} else {								\
 		__ret = scx_ops.op(args);					\
 	}									\
+	scx_op_stat_end(SCX_OP_IDX(op), __op_start);				\
 	__ret;									\
 })
 
@@ -481,6 +574,15 @@ static bool scx_ops_disabling(void)
 	return unlikely(scx_ops_enable_state() == SCX_OPS_DISABLING);
 }
 
+/* per-CPU wait_ops_state() statistics, reported in debugfs */
+struct scx_opss_wait_stat {
+	u64			nr;		/* number of waits which spun */
+	u64			nsecs;		/* total time spent waiting */
+	u64			max_nsecs;	/* longest wait */
+};
+
+static DEFINE_PER_CPU(struct scx_opss_wait_stat, scx_opss_wait_stats);
+
 /**
  * wait_ops_state - Busy-wait the specified ops state to end
  * @p: target task
@@ -490,12 +592,30 @@ static bool scx_ops_disabling(void)
  * state part of @opss is %SCX_QUEUEING or %SCX_DISPATCHING. This function also
  * has load_acquire semantics to ensure that the caller can see the updates made
  * in the enqueueing and dispatching paths.
+ *
+ * The callers hold an rq lock with IRQs disabled and can't sleep. Instead of
+ * hammering @p->scx.ops_state, wait with atomic64_cond_read_acquire() which
+ * lets architectures wait for the cacheline to change, e.g. with WFE on arm64.
+ * The number and duration of the waits which actually had to spin are
+ * recorded.
  */
 static void wait_ops_state(struct task_struct *p, u64 opss)
 {
-	do {
-		cpu_relax();
-	} while (atomic64_read_acquire(&p->scx.ops_state) == opss);
+	struct scx_opss_wait_stat *st;
+	u64 start, dur;
+
+	if (atomic64_read_acquire(&p->scx.ops_state) != opss)
+		return;
+
+	start = local_clock();
+	atomic64_cond_read_acquire(&p->scx.ops_state, VAL != (s64)opss);
+	dur = local_clock() - start;
+
+	st = this_cpu_ptr(&scx_opss_wait_stats);
+	st->nr++;
+	st->nsecs += dur;
+	if (dur > st->max_nsecs)
+		st->max_nsecs = dur;
 }
 
 /**
@@ -607,6 +727,81 @@ static bool scx_dsq_priq_less(struct rb_node *node_a,
 	return time_before64(a->scx.dsq_vtime, b->scx.dsq_vtime);
 }
 
+static bool scx_dsq_priq_edf_less(struct rb_node *node_a,
+				  const struct rb_node *node_b)
+{
+	const struct task_struct *a =
+		container_of(node_a, struct task_struct, scx.dsq_node.priq);
+	const struct task_struct *b =
+		container_of(node_b, struct task_struct, scx.dsq_node.priq);
+
+	if (a->scx.dsq_deadline != b->scx.dsq_deadline)
+		return time_before64(a->scx.dsq_deadline, b->scx.dsq_deadline);
+	return time_before64(a->scx.dsq_vtime, b->scx.dsq_vtime);
+}
+
+/*
+ * Whether any CPU @p can run on is currently idle. Always %false if the
+ * built-in idle tracking is disabled.
+ */
+static bool task_has_idle_cpu(struct task_struct *p)
+{
+#ifdef CONFIG_SMP
+	return static_branch_likely(&scx_builtin_idle_enabled) &&
+		cpumask_intersects(p->cpus_ptr, idle_masks.cpu);
+#else
+	return false;
+#endif
+}
+
+/*
+ * A CPU going idle while there are tasks it could run on a non-local DSQ is a
+ * common performance problem - e.g. ops.dispatch() didn't consume the DSQ or
+ * nobody kicked the CPU after the enqueue - which the watchdog only catches
+ * once it turns into a stall. To make it visible, while
+ * %scx_idle_pending_enabled, if there's an eligible idle CPU when a task is
+ * queued on a non-local DSQ, the time is recorded in p->scx.idle_pending_at and
+ * the time until the task leaves the DSQ is accounted in
+ * task_unlink_from_dsq().
+ *
+ * If %SCX_OPS_KICK_IDLE_ON_ENQ is set, an eligible idle CPU is also kicked
+ * after each enqueue. The CPU isn't claimed with scx_pick_idle_cpu(). Whether
+ * it consumes the DSQ is up to ops.dispatch() and claiming would hide it from
+ * ops.select_cpu() and scx_bpf_pick_idle_cpu() until it goes through idle
+ * again. Consecutive kicks are distributed across the idle CPUs.
+ */
+static void dispatch_enqueue_kick_idle(struct task_struct *p)
+{
+#ifdef CONFIG_SMP
+	u32 cpu;
+
+	if (!static_branch_likely(&scx_builtin_idle_enabled))
+		return;
+
+	cpu = cpumask_any_and_distribute(p->cpus_ptr, idle_masks.cpu);
+	if (cpu < nr_cpu_ids) {
+		scx_bpf_kick_cpu(cpu, 0);
+		atomic64_inc(&scx_nr_idle_kicks);
+	}
+#endif
+}
+
+static struct task_struct *first_dsq_task(struct scx_dispatch_q *dsq)
+{
+	struct rb_node *rb_node;
+
+	if (!list_empty(&dsq->fifo))
+		return list_first_entry(&dsq->fifo,
+					struct task_struct, scx.dsq_node.fifo);
+
+	rb_node = rb_first_cached(&dsq->priq);
+	if (rb_node)
+		return container_of(rb_node,
+				    struct task_struct, scx.dsq_node.priq);
+
+	return NULL;
+}
+
 static void dispatch_enqueue(struct scx_dispatch_q *dsq, struct task_struct *p,
 			     u64 enq_flags)
 {
@@ -617,6 +812,16 @@ static void dispatch_enqueue(struct scx_dispatch_q *dsq, struct task_struct *p,
 		     !RB_EMPTY_NODE(&p->scx.dsq_node.priq));
 
 	if (!is_local) {
+		/*
+		 * @p isn't on any DSQ yet and the store is ordered against
+		 * task_unlink_from_dsq() by @dsq->lock, so this can be done
+		 * before grabbing the lock.
+		 */
+		p->scx.idle_pending_at = 0;
+		if (static_branch_unlikely(&scx_idle_pending_enabled) &&
+		    task_has_idle_cpu(p))
+			p->scx.idle_pending_at = local_clock() ?: 1;
+
 		raw_spin_lock(&dsq->lock);
 		if (unlikely(dsq->id == SCX_DSQ_INVALID)) {
 			scx_ops_error("attempting to dispatch to a destroyed dsq");
@@ -629,8 +834,12 @@ static void dispatch_enqueue(struct scx_dispatch_q *dsq, struct task_struct *p,
 
 	if (enq_flags & SCX_ENQ_DSQ_PRIQ) {
 		p->scx.flags |= SCX_TASK_ON_DSQ_PRIQ;
-		rb_add_cached(&p->scx.dsq_node.priq, &dsq->priq,
-			      scx_dsq_priq_less);
+		if (dsq->flags & SCX_DSQ_ORDER_EDF)
+			rb_add_cached(&p->scx.dsq_node.priq, &dsq->priq,
+				      scx_dsq_priq_edf_less);
+		else
+			rb_add_cached(&p->scx.dsq_node.priq, &dsq->priq,
+				      scx_dsq_priq_less);
 	} else {
 		if (enq_flags & (SCX_ENQ_HEAD | SCX_ENQ_PREEMPT))
 			list_add(&p->scx.dsq_node.fifo, &dsq->fifo);
@@ -639,6 +848,7 @@ static void dispatch_enqueue(struct scx_dispatch_q *dsq, struct task_struct *p,
 	}
 	dsq->nr++;
 	p->scx.dsq = dsq;
+	p->scx.dsq_seq = ++dsq->seq;
 
 	/*
 	 * We're transitioning out of QUEUEING or DISPATCHING. store_release to
@@ -649,11 +859,19 @@ static void dispatch_enqueue(struct scx_dispatch_q *dsq, struct task_struct *p,
 
 	if (is_local) {
 		struct rq *rq = container_of(dsq, struct rq, scx.local_dsq);
+		struct task_struct *curr = rq->curr;
 		bool preempt = false;
 
-		if ((enq_flags & SCX_ENQ_PREEMPT) && p != rq->curr &&
-		    rq->curr->sched_class == &ext_sched_class) {
-			rq->curr->scx.slice = 0;
+		/*
+		 * FIFO tasks are picked before priq ones. Preempting for an
+		 * earlier vtime only makes sense if @p is going to run next.
+		 */
+		if ((enq_flags & (SCX_ENQ_PREEMPT | SCX_ENQ_PREEMPT_IF_EARLIER)) &&
+		    p != curr && curr->sched_class == &ext_sched_class &&
+		    ((enq_flags & SCX_ENQ_PREEMPT) ||
+		     (time_before64(p->scx.dsq_vtime, curr->scx.dsq_vtime) &&
+		      first_dsq_task(dsq) == p))) {
+			curr->scx.slice = 0;
 			preempt = true;
 		}
 
@@ -662,12 +880,33 @@ static void dispatch_enqueue(struct scx_dispatch_q *dsq, struct task_struct *p,
 			resched_curr(rq);
 	} else {
 		raw_spin_unlock(&dsq->lock);
+		if (static_branch_unlikely(&scx_ops_kick_idle_on_enq))
+			dispatch_enqueue_kick_idle(p);
 	}
 }
 
 static void task_unlink_from_dsq(struct task_struct *p,
 				 struct scx_dispatch_q *dsq)
 {
+	if (unlikely(p->scx.idle_pending_at)) {
+		struct scx_idle_pending_stat *st =
+			this_cpu_ptr(&scx_idle_pending_stats);
+		s64 delta;
+
+		/*
+		 * local_clock() isn't synchronized across CPUs and @p may have
+		 * been queued on a different one. Clamp if it went backwards.
+		 */
+		delta = max_t(s64, local_clock() - p->scx.idle_pending_at, 0);
+		st->nr++;
+		st->nsecs += delta;
+
+		/* only set for non-local DSQs, protected by @dsq->lock */
+		dsq->nr_idle_pending++;
+		dsq->idle_pending_nsecs += delta;
+		p->scx.idle_pending_at = 0;
+	}
+
 	if (p->scx.flags & SCX_TASK_ON_DSQ_PRIQ) {
 		rb_erase_cached(&p->scx.dsq_node.priq, &dsq->priq);
 		RB_CLEAR_NODE(&p->scx.dsq_node.priq);
@@ -740,6 +979,38 @@ static struct scx_dispatch_q *find_non_local_dsq(u64 dsq_id)
 					      dsq_hash_params);
 }
 
+#ifdef CONFIG_EXT_GROUP_SCHED
+/* the DSQ attached to @tg if %SCX_OPS_CGROUP_DSQ, %NULL otherwise */
+static struct scx_dispatch_q *tg_dsq(struct task_group *tg)
+{
+	return rcu_dereference_check(tg->scx_dsq, rcu_read_lock_any_held());
+}
+
+static struct scx_dispatch_q *cgroup_dsq(struct cgroup *cgrp)
+{
+	struct cgroup_subsys_state *css;
+
+	css = rcu_dereference_check(cgrp->subsys[cpu_cgrp_id],
+				    rcu_read_lock_any_held());
+	return css ? tg_dsq(css_tg(css)) : NULL;
+}
+
+static struct scx_dispatch_q *task_cgroup_dsq(struct task_struct *p)
+{
+	struct task_group *tg = task_group(p);
+
+	/* autogroups don't have DSQs, see scx_bpf_task_cgroup() */
+	if (!tg->css.cgroup)
+		tg = &root_task_group;
+	return tg_dsq(tg);
+}
+#else
+static struct scx_dispatch_q *task_cgroup_dsq(struct task_struct *p)
+{
+	return NULL;
+}
+#endif
+
 static struct scx_dispatch_q *find_dsq_for_dispatch(struct rq *rq, u64 dsq_id,
 						    struct task_struct *p)
 {
@@ -748,7 +1019,10 @@ static struct scx_dispatch_q *find_dsq_for_dispatch(struct rq *rq, u64 dsq_id,
 	if (dsq_id == SCX_DSQ_LOCAL)
 		return &rq->scx.local_dsq;
 
-	dsq = find_non_local_dsq(dsq_id);
+	if (dsq_id == SCX_DSQ_CGROUP)
+		dsq = task_cgroup_dsq(p);
+	else
+		dsq = find_non_local_dsq(dsq_id);
 	if (unlikely(!dsq)) {
 		scx_ops_error("non-existent DSQ 0x%llx for %s[%d]",
 			      dsq_id, p->comm, p->pid);
@@ -807,6 +1081,52 @@ static bool test_rq_online(struct rq *rq)
 #endif
 }
 
+static bool scx_ops_bypassed(void)
+{
+	return static_branch_unlikely(&scx_ops_auto_bypass) &&
+		unlikely(atomic_read(&scx_ops_bypassing));
+}
+
+/*
+ * The BPF scheduler is falling behind. Stop calling ops.enqueue() and
+ * ops.dispatch() until scx_bypass_workfn() hands control back. Can be called
+ * from any context.
+ */
+static void scx_ops_bypass_enter(void)
+{
+	if (atomic_read(&scx_ops_bypassing))
+		return;
+
+	/*
+	 * scx_bypass_workfn() may run on another CPU and must not see the flag
+	 * together with the previous bypass's timestamp. Update the timestamp
+	 * first and publish with release, paired with the acquire in
+	 * scx_bypass_workfn(). A racing loser may push the timestamp forward a
+	 * bit, which only makes the bypass slightly longer.
+	 */
+	WRITE_ONCE(scx_bypass_entered_at, jiffies);
+	if (atomic_cmpxchg_release(&scx_ops_bypassing, 0, 1))
+		return;
+
+	atomic64_inc(&scx_nr_bypasses);
+}
+
+/*
+ * Slice for tasks which the core places on DSQs by itself. See
+ * %SCX_OPS_ADAPTIVE_SLICE.
+ */
+static u64 scx_core_slice(struct rq *rq)
+{
+	u64 slice = READ_ONCE(scx_slice_dfl);
+	u32 nr_running = rq->scx.nr_running;
+
+	if (static_branch_unlikely(&scx_ops_adaptive_slice) && nr_running > 1)
+		slice = max_t(u64, div_u64(slice, nr_running),
+			      SCX_SLICE_ADAPTIVE_MIN);
+
+	return slice;
+}
+
 static void do_enqueue_task(struct rq *rq, struct task_struct *p, u64 enq_flags,
 			    int sticky_cpu)
 {
@@ -842,6 +1162,10 @@ static void do_enqueue_task(struct rq *rq, struct task_struct *p, u64 enq_flags,
 	    (enq_flags & SCX_ENQ_LAST))
 		goto local;
 
+	/* see scx_ops_bypass_enter() */
+	if (scx_ops_bypassed())
+		goto local;
+
 	if (!SCX_HAS_OP(enqueue)) {
 		if (enq_flags & SCX_ENQ_LOCAL)
 			goto local;
@@ -877,14 +1201,14 @@ static void do_enqueue_task(struct rq *rq, struct task_struct *p, u64 enq_flags,
 	 * higher priority it becomes from scx_prio_less()'s POV.
 	 */
 	touch_core_sched(rq, p);
-	p->scx.slice = SCX_SLICE_DFL;
+	p->scx.slice = scx_core_slice(rq);
 local_norefill:
 	dispatch_enqueue(&rq->scx.local_dsq, p, enq_flags);
 	return;
 
 global:
 	touch_core_sched(rq, p);	/* see the comment in local: */
-	p->scx.slice = SCX_SLICE_DFL;
+	p->scx.slice = scx_core_slice(rq);
 	dispatch_enqueue(&scx_dsq_global, p, enq_flags);
 }
 
@@ -1190,26 +1514,118 @@ static bool task_can_run_on_rq(struct task_struct *p, struct rq *rq)
 		cpumask_test_cpu(cpu_of(rq), p->cpus_ptr);
 }
 
+/**
+ * task_since_ran - Estimate how long ago a task last ran
+ * @p: task of interest
+ *
+ * Return the number of nsecs since @p last stopped running on its current rq,
+ * or 0 if @p is running. @p->se.exec_start is updated by update_curr_scx() and
+ * thus is the task clock timestamp of when @p last ran. The clock of @p's rq is
+ * read without holding its lock, so the result is only an estimate.
+ */
+static u64 task_since_ran(const struct task_struct *p)
+{
+	struct rq *rq = task_rq(p);
+	s64 delta;
+
+	if (rq->curr == p)
+		return 0;
+
+	delta = READ_ONCE(rq->clock_task) - p->se.exec_start;
+	return delta > 0 ? delta : 0;
+}
+
+/**
+ * task_cache_hot - Would moving a task to a CPU throw away a warm cache?
+ * @p: task of interest
+ * @cpu: CPU @p may be moved to
+ *
+ * Mirrors the migration cost test in fair.c's task_hot(). @p is considered
+ * cache-hot if it last ran on a CPU which doesn't share the LLC with @cpu less
+ * than sysctl_sched_migration_cost ago.
+ */
+static bool task_cache_hot(const struct task_struct *p, s32 cpu)
+{
+	if (cpus_share_cache(task_cpu(p), cpu))
+		return false;
+
+	if (sysctl_sched_migration_cost == -1)
+		return true;
+	if (sysctl_sched_migration_cost == 0)
+		return false;
+
+	return task_since_ran(p) < sysctl_sched_migration_cost;
+}
+
+/*
+ * Fill @info with the state of the head task of @dsq which must be locked.
+ * Returns %false if @dsq is empty.
+ */
+static bool peek_dsq_head(struct scx_dispatch_q *dsq,
+			  struct scx_dsq_peek_info *info)
+{
+	struct task_struct *p = first_dsq_task(dsq);
+
+	if (!p)
+		return false;
+
+	info->dsq_vtime = p->scx.dsq_vtime;
+	info->dsq_deadline = p->scx.dsq_deadline;
+	info->runnable_at = p->scx.runnable_at;
+	info->seq = p->scx.dsq_seq;
+	info->pid = p->pid;
+	return true;
+}
+
+/*
+ * Transfer the first task on @dsq which can run on @rq to @rq's local DSQ. If
+ * @head_seq is not zero, only the head task of @dsq is considered and it's
+ * consumed only if it was queued with p->scx.dsq_seq == @head_seq.
+ */
 static bool consume_dispatch_q(struct rq *rq, struct rq_flags *rf,
-			       struct scx_dispatch_q *dsq)
+			       struct scx_dispatch_q *dsq, u64 head_seq)
 {
 	struct scx_rq *scx_rq = &rq->scx;
-	struct task_struct *p;
+	struct task_struct *p, *hot_p;
 	struct rb_node *rb_node;
 	struct rq *task_rq;
-	bool moved = false;
+	bool cold_first = static_branch_unlikely(&scx_ops_consume_cold_first);
+	bool moved = false, on_priq;
 retry:
 	if (list_empty(&dsq->fifo) && !rb_first_cached(&dsq->priq))
 		return false;
 
 	raw_spin_lock(&dsq->lock);
 
-	list_for_each_entry(p, &dsq->fifo, scx.dsq_node.fifo) {
+	/*
+	 * With %SCX_OPS_CONSUME_COLD_FIRST, remote tasks which are cache-hot on
+	 * another LLC are skipped over in favor of the first cold one. If there
+	 * is none, fall back to the first hot one.
+	 */
+	hot_p = NULL;
+
+	if (head_seq) {
+		p = first_dsq_task(dsq);
+		if (!p || p->scx.dsq_seq != head_seq)
+			goto out_unlock;
 		task_rq = task_rq(p);
 		if (rq == task_rq)
 			goto this_rq;
 		if (task_can_run_on_rq(p, rq))
 			goto remote_rq;
+		goto out_unlock;
+	}
+
+	list_for_each_entry(p, &dsq->fifo, scx.dsq_node.fifo) {
+		task_rq = task_rq(p);
+		if (rq == task_rq)
+			goto this_rq;
+		if (task_can_run_on_rq(p, rq)) {
+			if (!cold_first || !task_cache_hot(p, cpu_of(rq)))
+				goto remote_rq;
+			if (!hot_p)
+				hot_p = p;
+		}
 	}
 
 	for (rb_node = rb_first_cached(&dsq->priq); rb_node;
@@ -1218,18 +1634,42 @@ static bool consume_dispatch_q(struct rq *rq, struct rq_flags *rf,
 		task_rq = task_rq(p);
 		if (rq == task_rq)
 			goto this_rq;
-		if (task_can_run_on_rq(p, rq))
-			goto remote_rq;
+		if (task_can_run_on_rq(p, rq)) {
+			if (!cold_first || !task_cache_hot(p, cpu_of(rq)))
+				goto remote_rq;
+			if (!hot_p)
+				hot_p = p;
+		}
+	}
+
+	if (hot_p) {
+		p = hot_p;
+		task_rq = task_rq(p);
+		goto remote_rq;
 	}
 
+out_unlock:
 	raw_spin_unlock(&dsq->lock);
 	return false;
 
 this_rq:
-	/* @dsq is locked and @p is on this rq */
+	/*
+	 * @dsq is locked and @p is on this rq. If @p was on @dsq's vtime
+	 * ordered priority queue, keep it vtime ordered on the local DSQ too.
+	 * Local DSQs don't do EDF ordering. Tasks from EDF DSQs are consumed
+	 * in deadline order and go on the local FIFO.
+	 */
 	WARN_ON_ONCE(p->scx.holding_cpu >= 0);
+	on_priq = (p->scx.flags & SCX_TASK_ON_DSQ_PRIQ) &&
+		!(dsq->flags & SCX_DSQ_ORDER_EDF);
 	task_unlink_from_dsq(p, dsq);
-	list_add_tail(&p->scx.dsq_node.fifo, &scx_rq->local_dsq.fifo);
+	if (on_priq) {
+		p->scx.flags |= SCX_TASK_ON_DSQ_PRIQ;
+		rb_add_cached(&p->scx.dsq_node.priq, &scx_rq->local_dsq.priq,
+			      scx_dsq_priq_less);
+	} else {
+		list_add_tail(&p->scx.dsq_node.fifo, &scx_rq->local_dsq.fifo);
+	}
 	dsq->nr--;
 	scx_rq->local_dsq.nr++;
 	p->scx.dsq = &scx_rq->local_dsq;
@@ -1246,6 +1686,8 @@ static bool consume_dispatch_q(struct rq *rq, struct rq_flags *rf,
 	 * move_task_to_local_dsq().
 	 */
 	WARN_ON_ONCE(p->scx.holding_cpu >= 0);
+	on_priq = (p->scx.flags & SCX_TASK_ON_DSQ_PRIQ) &&
+		!(dsq->flags & SCX_DSQ_ORDER_EDF);
 	task_unlink_from_dsq(p, dsq);
 	dsq->nr--;
 	p->scx.holding_cpu = raw_smp_processor_id();
@@ -1255,7 +1697,7 @@ static bool consume_dispatch_q(struct rq *rq, struct rq_flags *rf,
 	double_lock_balance(rq, task_rq);
 	rq_repin_lock(rq, rf);
 
-	moved = move_task_to_local_dsq(rq, p, 0);
+	moved = move_task_to_local_dsq(rq, p, on_priq ? SCX_ENQ_DSQ_PRIQ : 0);
 
 	double_unlock_balance(rq, task_rq);
 #endif /* CONFIG_SMP */
@@ -1545,10 +1987,10 @@ static int balance_one(struct rq *rq, struct task_struct *prev,
 	if (scx_rq->local_dsq.nr)
 		return 1;
 
-	if (consume_dispatch_q(rq, rf, &scx_dsq_global))
+	if (consume_dispatch_q(rq, rf, &scx_dsq_global, 0))
 		return 1;
 
-	if (!SCX_HAS_OP(dispatch))
+	if (!SCX_HAS_OP(dispatch) || scx_ops_bypassed())
 		return 0;
 
 	dspc->rq = rq;
@@ -1571,7 +2013,7 @@ static int balance_one(struct rq *rq, struct task_struct *prev,
 
 		if (scx_rq->local_dsq.nr)
 			return 1;
-		if (consume_dispatch_q(rq, rf, &scx_dsq_global))
+		if (consume_dispatch_q(rq, rf, &scx_dsq_global, 0))
 			return 1;
 
 		/*
@@ -1585,6 +2027,11 @@ static int balance_one(struct rq *rq, struct task_struct *prev,
 		 */
 		if (unlikely(!--nr_loops)) {
 			scx_bpf_kick_cpu(cpu_of(rq), 0);
+			if (static_branch_unlikely(&scx_ops_auto_bypass) &&
+			    scx_bypass_nr_dsp_exhausts &&
+			    atomic_inc_return(&scx_bypass_dsp_exhausts) >=
+			    scx_bypass_nr_dsp_exhausts)
+				scx_ops_bypass_enter();
 			break;
 		}
 	} while (dspc->nr_tasks);
@@ -1741,7 +2188,7 @@ static void put_prev_task_scx(struct rq *rq, struct task_struct *p)
 		 * can find the task unless it wants to trigger a separate
 		 * follow-up scheduling event.
 		 */
-		if (list_empty(&rq->scx.local_dsq.fifo))
+		if (!rq->scx.local_dsq.nr)
 			do_enqueue_task(rq, p, SCX_ENQ_LAST | SCX_ENQ_LOCAL, -1);
 		else
 			do_enqueue_task(rq, p, 0, -1);
@@ -1750,18 +2197,7 @@ static void put_prev_task_scx(struct rq *rq, struct task_struct *p)
 
 static struct task_struct *first_local_task(struct rq *rq)
 {
-	struct rb_node *rb_node;
-
-	if (!list_empty(&rq->scx.local_dsq.fifo))
-		return list_first_entry(&rq->scx.local_dsq.fifo,
-					struct task_struct, scx.dsq_node.fifo);
-
-	rb_node = rb_first_cached(&rq->scx.local_dsq.priq);
-	if (rb_node)
-		return container_of(rb_node,
-				    struct task_struct, scx.dsq_node.priq);
-
-	return NULL;
+	return first_dsq_task(&rq->scx.local_dsq);
 }
 
 static struct task_struct *pick_next_task_scx(struct rq *rq)
@@ -1784,7 +2220,7 @@ static struct task_struct *pick_next_task_scx(struct rq *rq)
 					p->comm, p->pid);
 			scx_warned_zero_slice = true;
 		}
-		p->scx.slice = SCX_SLICE_DFL;
+		p->scx.slice = scx_core_slice(rq);
 	}
 
 	set_next_task_scx(rq, p, true);
@@ -2034,6 +2470,12 @@ static s32 scx_select_cpu_dfl(struct task_struct *p, s32 prev_cpu, u64 wake_flag
 
 static int select_task_rq_scx(struct task_struct *p, int prev_cpu, int wake_flags)
 {
+	if (unlikely(scx_ops_bypassed())) {
+		if (static_branch_likely(&scx_builtin_idle_enabled))
+			return scx_select_cpu_dfl(p, prev_cpu, wake_flags);
+		return prev_cpu;
+	}
+
 	if (SCX_HAS_OP(select_cpu)) {
 		s32 cpu;
 
@@ -2050,10 +2492,64 @@ static int select_task_rq_scx(struct task_struct *p, int prev_cpu, int wake_flag
 	}
 }
 
+static u32 affn_class_find(const struct cpumask *mask, u32 hash, u32 from,
+			   u32 to)
+{
+	u32 id;
+
+	for (id = from; id < to; id++)
+		if (scx_affn_hashes[id] == hash &&
+		    cpumask_equal(scx_affn_masks[id], mask))
+			return id;
+
+	return SCX_AFFN_CLASS_NONE;
+}
+
+/**
+ * scx_affn_class_intern - Determine the affinity class of a task
+ * @p: task of interest
+ *
+ * Look up the affinity class matching @p->cpus_ptr, creating a new one if
+ * there's none yet and the table isn't full. Tasks which are pinned to a
+ * single CPU, including temporarily through migrate_disable(), don't belong to
+ * any class as the CPU already identifies them.
+ */
+static u32 scx_affn_class_intern(struct task_struct *p)
+{
+	const struct cpumask *mask = p->cpus_ptr;
+	unsigned long flags;
+	u32 hash, nr, id;
+
+	if (p->nr_cpus_allowed <= 1 || mask != &p->cpus_mask)
+		return SCX_AFFN_CLASS_NONE;
+
+	hash = jhash(cpumask_bits(mask), BITS_TO_LONGS(nr_cpu_ids) * sizeof(long),
+		     0);
+
+	nr = smp_load_acquire(&scx_nr_affn_classes);
+	id = affn_class_find(mask, hash, 0, nr);
+	if (id != SCX_AFFN_CLASS_NONE)
+		return id;
+
+	raw_spin_lock_irqsave(&scx_affn_lock, flags);
+	id = affn_class_find(mask, hash, nr, scx_nr_affn_classes);
+	if (id == SCX_AFFN_CLASS_NONE &&
+	    scx_nr_affn_classes < SCX_NR_AFFN_CLASSES) {
+		id = scx_nr_affn_classes;
+		cpumask_copy(scx_affn_masks[id], mask);
+		scx_affn_hashes[id] = hash;
+		smp_store_release(&scx_nr_affn_classes, id + 1);
+	}
+	raw_spin_unlock_irqrestore(&scx_affn_lock, flags);
+
+	return id;
+}
+
 static void set_cpus_allowed_scx(struct task_struct *p,
 				 struct affinity_context *ac)
 {
 	set_cpus_allowed_common(p, ac);
+	p->scx.affn_class = scx_affn_class_intern(p);
 
 	/*
 	 * The effective cpumask is stored in @p->cpus_ptr which may temporarily
@@ -2174,6 +2670,57 @@ static void scx_watchdog_workfn(struct work_struct *work)
 			   scx_watchdog_timeout / 2);
 }
 
+static bool rq_has_aged_task(struct rq *rq)
+{
+	unsigned long since = READ_ONCE(scx_bypass_left_at);
+	struct task_struct *p;
+	struct rq_flags rf;
+	bool aged = false;
+
+	rq_lock_irqsave(rq, &rf);
+	list_for_each_entry(p, &rq->scx.watchdog_list, scx.watchdog_node) {
+		unsigned long runnable_at = p->scx.runnable_at;
+
+		/* don't count the time spent waiting for the last bypass */
+		if (time_before(runnable_at, since))
+			runnable_at = since;
+
+		if (time_after(jiffies, runnable_at + scx_bypass_age)) {
+			aged = true;
+			break;
+		}
+	}
+	rq_unlock_irqrestore(rq, &rf);
+
+	return aged;
+}
+
+static void scx_bypass_workfn(struct work_struct *work)
+{
+	int cpu;
+
+	if (atomic_read_acquire(&scx_ops_bypassing)) {
+		if (time_after_eq(jiffies, READ_ONCE(scx_bypass_entered_at) +
+					   scx_bypass_age)) {
+			WRITE_ONCE(scx_bypass_left_at, jiffies);
+			atomic_set(&scx_bypass_dsp_exhausts, 0);
+			atomic_set(&scx_ops_bypassing, 0);
+		}
+	} else {
+		atomic_set(&scx_bypass_dsp_exhausts, 0);
+		for_each_online_cpu(cpu) {
+			if (rq_has_aged_task(cpu_rq(cpu))) {
+				scx_ops_bypass_enter();
+				break;
+			}
+			cond_resched();
+		}
+	}
+
+	queue_delayed_work(system_unbound_wq, to_delayed_work(work),
+			   max(scx_bypass_age / 2, 1UL));
+}
+
 static void task_tick_scx(struct rq *rq, struct task_struct *curr, int queued)
 {
 	update_curr_scx(rq);
@@ -2220,6 +2767,8 @@ static int scx_ops_prepare_task(struct task_struct *p, struct task_group *tg)
 	WARN_ON_ONCE(p->scx.flags & SCX_TASK_OPS_PREPPED);
 
 	p->scx.disallow = false;
+	p->scx.affn_class = scx_affn_class_intern(p);
+	memset(p->scx.sched_data, 0, sizeof(p->scx.sched_data));
 
 	if (SCX_HAS_OP(prep_enable)) {
 		struct scx_enable_args args = {
@@ -2411,6 +2960,7 @@ static void switching_to_scx(struct rq *rq, struct task_struct *p)
 	 * set_cpus_allowed_scx() is not called while @p is associated with a
 	 * different scheduler class. Keep the BPF scheduler up-to-date.
 	 */
+	p->scx.affn_class = scx_affn_class_intern(p);
 	if (SCX_HAS_OP(set_cpumask))
 		SCX_CALL_OP_TASK(SCX_KF_REST, set_cpumask, p,
 				 (struct cpumask *)p->cpus_ptr);
@@ -2455,6 +3005,9 @@ bool scx_can_stop_tick(struct rq *rq)
 
 DEFINE_STATIC_PERCPU_RWSEM(scx_cgroup_rwsem);
 
+static int tg_create_dsq(struct task_group *tg);
+static void tg_destroy_dsq(struct task_group *tg);
+
 int scx_tg_online(struct task_group *tg)
 {
 	int ret = 0;
@@ -2463,19 +3016,29 @@ int scx_tg_online(struct task_group *tg)
 
 	percpu_down_read(&scx_cgroup_rwsem);
 
+	ret = tg_create_dsq(tg);
+	if (ret)
+		goto out_unlock;
+
 	if (SCX_HAS_OP(cgroup_init)) {
 		struct scx_cgroup_init_args args = { .weight = tg->scx_weight };
 
 		ret = SCX_CALL_OP_RET(SCX_KF_SLEEPABLE, cgroup_init,
 				      tg->css.cgroup, &args);
-		if (!ret)
+		if (!ret) {
 			tg->scx_flags |= SCX_TG_ONLINE | SCX_TG_INITED;
-		else
+		} else {
+			tg_destroy_dsq(tg);
 			ret = ops_sanitize_err("cgroup_init", ret);
+		}
+	} else if (rcu_access_pointer(tg->scx_dsq)) {
+		/* the DSQ is torn down by scx_cgroup_exit() only if INITED */
+		tg->scx_flags |= SCX_TG_ONLINE | SCX_TG_INITED;
 	} else {
 		tg->scx_flags |= SCX_TG_ONLINE;
 	}
 
+out_unlock:
 	percpu_up_read(&scx_cgroup_rwsem);
 	return ret;
 }
@@ -2488,6 +3051,7 @@ void scx_tg_offline(struct task_group *tg)
 
 	if (SCX_HAS_OP(cgroup_exit) && (tg->scx_flags & SCX_TG_INITED))
 		SCX_CALL_OP(SCX_KF_SLEEPABLE, cgroup_exit, tg->css.cgroup);
+	tg_destroy_dsq(tg);
 	tg->scx_flags &= ~(SCX_TG_ONLINE | SCX_TG_INITED);
 
 	percpu_up_read(&scx_cgroup_rwsem);
@@ -2675,12 +3239,13 @@ static void init_dsq(struct scx_dispatch_q *dsq, u64 dsq_id)
 	dsq->id = dsq_id;
 }
 
-static struct scx_dispatch_q *create_dsq(u64 dsq_id, int node)
+static struct scx_dispatch_q *create_dsq(u64 dsq_id, int node, u32 max_nr,
+				       u64 flags)
 {
 	struct scx_dispatch_q *dsq;
 	int ret;
 
-	if (dsq_id & SCX_DSQ_FLAG_BUILTIN)
+	if ((dsq_id & SCX_DSQ_FLAG_BUILTIN) || (flags & ~SCX_DSQ_ALL_FLAGS))
 		return ERR_PTR(-EINVAL);
 
 	dsq = kmalloc_node(sizeof(*dsq), GFP_KERNEL, node);
@@ -2688,6 +3253,8 @@ static struct scx_dispatch_q *create_dsq(u64 dsq_id, int node)
 		return ERR_PTR(-ENOMEM);
 
 	init_dsq(dsq, dsq_id);
+	dsq->max_nr = max_nr;
+	dsq->flags = flags;
 
 	ret = rhashtable_insert_fast(&dsq_hash, &dsq->hash_node,
 				     dsq_hash_params);
@@ -2748,6 +3315,75 @@ static void destroy_dsq(u64 dsq_id)
 }
 
 #ifdef CONFIG_EXT_GROUP_SCHED
+/*
+ * Create the DSQ attached to @tg if %SCX_OPS_CGROUP_DSQ. The DSQ isn't on
+ * dsq_hash and is only reachable through @tg. Its ID is the cgroup ID for
+ * error messages.
+ */
+static int tg_create_dsq(struct task_group *tg)
+{
+	struct scx_dispatch_q *dsq;
+
+	percpu_rwsem_assert_held(&scx_cgroup_rwsem);
+
+	if (!static_branch_unlikely(&scx_ops_cgroup_dsq) ||
+	    rcu_access_pointer(tg->scx_dsq))
+		return 0;
+
+	dsq = kmalloc(sizeof(*dsq), GFP_KERNEL);
+	if (!dsq)
+		return -ENOMEM;
+
+	init_dsq(dsq, cgroup_id(tg->css.cgroup));
+	rcu_assign_pointer(tg->scx_dsq, dsq);
+	return 0;
+}
+
+static void tg_destroy_dsq(struct task_group *tg)
+{
+	struct scx_dispatch_q *dsq;
+	struct task_struct *p;
+	unsigned long flags;
+
+	percpu_rwsem_assert_held(&scx_cgroup_rwsem);
+
+	dsq = rcu_dereference_protected(tg->scx_dsq, true);
+	if (!dsq)
+		return;
+
+	RCU_INIT_POINTER(tg->scx_dsq, NULL);
+
+	/*
+	 * Tasks may still be queued, e.g. when the BPF scheduler is being
+	 * disabled or dispatched a task right before it migrated out of @tg.
+	 * Move them to the global DSQ so that they don't get stranded. @p's
+	 * rq lock is needed to dequeue it, see dispatch_dequeue().
+	 */
+	raw_spin_lock_irqsave(&dsq->lock, flags);
+	while ((p = first_dsq_task(dsq))) {
+		struct rq_flags rf;
+		struct rq *rq;
+
+		get_task_struct(p);
+		raw_spin_unlock_irqrestore(&dsq->lock, flags);
+
+		rq = task_rq_lock(p, &rf);
+		if (p->scx.dsq == dsq) {
+			dispatch_dequeue(&rq->scx, p);
+			dispatch_enqueue(&scx_dsq_global, p, 0);
+		}
+		task_rq_unlock(rq, p, &rf);
+		put_task_struct(p);
+
+		raw_spin_lock_irqsave(&dsq->lock, flags);
+	}
+	/* see destroy_dsq() */
+	dsq->id = SCX_DSQ_INVALID;
+	raw_spin_unlock_irqrestore(&dsq->lock, flags);
+
+	kfree_rcu(dsq, rcu);
+}
+
 static void scx_cgroup_exit(void)
 {
 	struct cgroup_subsys_state *css;
@@ -2766,14 +3402,17 @@ static void scx_cgroup_exit(void)
 			continue;
 		tg->scx_flags &= ~SCX_TG_INITED;
 
-		if (!scx_ops.cgroup_exit)
+		if (!scx_ops.cgroup_exit) {
+			tg_destroy_dsq(tg);
 			continue;
+		}
 
 		if (WARN_ON_ONCE(!css_tryget(css)))
 			continue;
 		rcu_read_unlock();
 
 		SCX_CALL_OP(SCX_KF_UNLOCKED, cgroup_exit, css->cgroup);
+		tg_destroy_dsq(tg);
 
 		rcu_read_lock();
 		css_put(css);
@@ -2801,7 +3440,8 @@ static int scx_cgroup_init(void)
 		     (SCX_TG_ONLINE | SCX_TG_INITED)) != SCX_TG_ONLINE)
 			continue;
 
-		if (!scx_ops.cgroup_init) {
+		if (!scx_ops.cgroup_init &&
+		    !static_branch_unlikely(&scx_ops_cgroup_dsq)) {
 			tg->scx_flags |= SCX_TG_INITED;
 			continue;
 		}
@@ -2810,9 +3450,12 @@ static int scx_cgroup_init(void)
 			continue;
 		rcu_read_unlock();
 
-		ret = SCX_CALL_OP_RET(SCX_KF_SLEEPABLE, cgroup_init,
-				      css->cgroup, &args);
+		ret = tg_create_dsq(tg);
+		if (!ret && scx_ops.cgroup_init)
+			ret = SCX_CALL_OP_RET(SCX_KF_SLEEPABLE, cgroup_init,
+					      css->cgroup, &args);
 		if (ret) {
+			tg_destroy_dsq(tg);
 			css_put(css);
 			return ret;
 		}
@@ -2887,14 +3530,56 @@ bool task_should_scx(struct task_struct *p)
 
 static void scx_ops_fallback_enqueue(struct task_struct *p, u64 enq_flags)
 {
+	u64 slice = scx_core_slice(task_rq(p));
+
 	if (enq_flags & SCX_ENQ_LAST)
-		scx_bpf_dispatch(p, SCX_DSQ_LOCAL, SCX_SLICE_DFL, enq_flags);
+		scx_bpf_dispatch(p, SCX_DSQ_LOCAL, slice, enq_flags);
 	else
-		scx_bpf_dispatch(p, SCX_DSQ_GLOBAL, SCX_SLICE_DFL, enq_flags);
+		scx_bpf_dispatch(p, SCX_DSQ_GLOBAL, slice, enq_flags);
 }
 
 static void scx_ops_fallback_dispatch(s32 cpu, struct task_struct *prev) {}
 
+static int alloc_cpu_ctxs(u32 size)
+{
+	int cpu;
+
+	if (!size)
+		return 0;
+
+	/* on failure, the disable path frees the ones already allocated */
+	for_each_possible_cpu(cpu) {
+		void *ctx = kzalloc_node(size, GFP_KERNEL, cpu_to_node(cpu));
+
+		if (!ctx)
+			return -ENOMEM;
+		cpu_rq(cpu)->scx.cpu_ctx = ctx;
+	}
+
+	return 0;
+}
+
+/*
+ * BPF async callbacks, e.g. bpf_timer, aren't synchronized against disabling
+ * and may still be looking at the areas. They run under RCU, so unpublish and
+ * free after a grace period.
+ */
+static void free_cpu_ctxs(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct rq *rq = cpu_rq(cpu);
+		void *ctx = rq->scx.cpu_ctx;
+
+		if (!ctx)
+			continue;
+
+		WRITE_ONCE(rq->scx.cpu_ctx, NULL);
+		kfree_rcu_mightsleep(ctx);
+	}
+}
+
 static void scx_ops_disable_workfn(struct kthread_work *work)
 {
 	struct scx_exit_info *ei = &scx_exit_info;
@@ -2919,6 +3604,8 @@ static void scx_ops_disable_workfn(struct kthread_work *work)
 	}
 
 	cancel_delayed_work_sync(&scx_watchdog_work);
+	cancel_delayed_work_sync(&scx_bypass_work);
+	atomic_set(&scx_ops_bypassing, 0);
 
 	switch (type) {
 	case SCX_EXIT_UNREG:
@@ -3054,6 +3741,11 @@ static void scx_ops_disable_workfn(struct kthread_work *work)
 		static_branch_disable_cpuslocked(&scx_has_op[i]);
 	static_branch_disable_cpuslocked(&scx_ops_enq_last);
 	static_branch_disable_cpuslocked(&scx_ops_enq_exiting);
+	static_branch_disable_cpuslocked(&scx_ops_consume_cold_first);
+	static_branch_disable_cpuslocked(&scx_ops_adaptive_slice);
+	static_branch_disable_cpuslocked(&scx_ops_kick_idle_on_enq);
+	static_branch_disable_cpuslocked(&scx_ops_cgroup_dsq);
+	static_branch_disable_cpuslocked(&scx_ops_auto_bypass);
 	static_branch_disable_cpuslocked(&scx_ops_cpu_preempt);
 	static_branch_disable_cpuslocked(&scx_builtin_idle_enabled);
 	synchronize_rcu();
@@ -3095,6 +3787,8 @@ static void scx_ops_disable_workfn(struct kthread_work *work)
 	scx_dsp_buf = NULL;
 	scx_dsp_max_batch = 0;
 
+	free_cpu_ctxs();
+
 	mutex_unlock(&scx_ops_enable_mutex);
 
 	WARN_ON_ONCE(scx_ops_set_enable_state(SCX_OPS_DISABLED) !=
@@ -3187,6 +3881,25 @@ static int scx_ops_enable(struct sched_ext_ops *ops)
 		goto err_unlock;
 	}
 
+	/*
+	 * The watchdog isn't aware of bypass and tasks held on the BPF side keep
+	 * aging while bypassing. Bypass must trigger well before the watchdog
+	 * would abort the BPF scheduler.
+	 */
+	if (ops->bypass_age_ms &&
+	    msecs_to_jiffies(ops->bypass_age_ms) >=
+	    (ops->timeout_ms ? msecs_to_jiffies(ops->timeout_ms) :
+			       SCX_WATCHDOG_MAX_TIMEOUT) / 2) {
+		ret = -EINVAL;
+		goto err_unlock;
+	}
+
+	if (!IS_ENABLED(CONFIG_EXT_GROUP_SCHED) &&
+	    (ops->flags & SCX_OPS_CGROUP_DSQ)) {
+		ret = -EINVAL;
+		goto err_unlock;
+	}
+
 	/*
 	 * Set scx_ops, transition to PREPPING and clear exit info to arm the
 	 * disable path. Failure triggers full disabling from here on.
@@ -3202,12 +3915,20 @@ static int scx_ops_enable(struct sched_ext_ops *ops)
 
 	atomic64_set(&scx_nr_rejected, 0);
 
+	raw_spin_lock_irq(&scx_affn_lock);
+	WRITE_ONCE(scx_nr_affn_classes, 0);
+	raw_spin_unlock_irq(&scx_affn_lock);
+
 	/*
 	 * Keep CPUs stable during enable so that the BPF scheduler can track
 	 * online CPUs by watching ->on/offline_cpu() after ->init().
 	 */
 	cpus_read_lock();
 
+	ret = alloc_cpu_ctxs(ops->cpu_ctx_size);
+	if (ret)
+		goto err_disable;
+
 	scx_switch_all_req = false;
 	if (scx_ops.init) {
 		ret = SCX_CALL_OP_RET(SCX_KF_INIT, init);
@@ -3237,6 +3958,8 @@ static int scx_ops_enable(struct sched_ext_ops *ops)
 		goto err_disable;
 	}
 
+	WRITE_ONCE(scx_slice_dfl, ops->slice_dfl_ns ?: SCX_SLICE_DFL);
+
 	scx_watchdog_timeout = SCX_WATCHDOG_MAX_TIMEOUT;
 	if (ops->timeout_ms)
 		scx_watchdog_timeout = msecs_to_jiffies(ops->timeout_ms);
@@ -3245,6 +3968,15 @@ static int scx_ops_enable(struct sched_ext_ops *ops)
 	queue_delayed_work(system_unbound_wq, &scx_watchdog_work,
 			   scx_watchdog_timeout / 2);
 
+	if (ops->bypass_age_ms) {
+		scx_bypass_age = msecs_to_jiffies(ops->bypass_age_ms);
+		scx_bypass_nr_dsp_exhausts = ops->bypass_nr_dsp_exhausts;
+		scx_bypass_left_at = jiffies;
+		atomic_set(&scx_bypass_dsp_exhausts, 0);
+		queue_delayed_work(system_unbound_wq, &scx_bypass_work,
+				   max(scx_bypass_age / 2, 1UL));
+	}
+
 	/*
 	 * Lock out forks, cgroup on/offlining and moves before opening the
 	 * floodgate so that they don't wander into the operations prematurely.
@@ -3261,6 +3993,16 @@ static int scx_ops_enable(struct sched_ext_ops *ops)
 
 	if (ops->flags & SCX_OPS_ENQ_EXITING)
 		static_branch_enable_cpuslocked(&scx_ops_enq_exiting);
+	if (ops->flags & SCX_OPS_CONSUME_COLD_FIRST)
+		static_branch_enable_cpuslocked(&scx_ops_consume_cold_first);
+	if (ops->flags & SCX_OPS_ADAPTIVE_SLICE)
+		static_branch_enable_cpuslocked(&scx_ops_adaptive_slice);
+	if (ops->flags & SCX_OPS_KICK_IDLE_ON_ENQ)
+		static_branch_enable_cpuslocked(&scx_ops_kick_idle_on_enq);
+	if (ops->flags & SCX_OPS_CGROUP_DSQ)
+		static_branch_enable_cpuslocked(&scx_ops_cgroup_dsq);
+	if (ops->bypass_age_ms)
+		static_branch_enable_cpuslocked(&scx_ops_auto_bypass);
 	if (scx_ops.cpu_acquire || scx_ops.cpu_release)
 		static_branch_enable_cpuslocked(&scx_ops_cpu_preempt);
 
@@ -3404,6 +4146,101 @@ static const char *scx_ops_enable_state_str[] = {
 	[SCX_OPS_DISABLED]	= "disabled",
 };
 
+static const char *scx_op_names[SCX_NR_OPS] = {
+	[SCX_OP_IDX(select_cpu)]		= "select_cpu",
+	[SCX_OP_IDX(enqueue)]			= "enqueue",
+	[SCX_OP_IDX(dequeue)]			= "dequeue",
+	[SCX_OP_IDX(dispatch)]			= "dispatch",
+	[SCX_OP_IDX(runnable)]			= "runnable",
+	[SCX_OP_IDX(running)]			= "running",
+	[SCX_OP_IDX(stopping)]			= "stopping",
+	[SCX_OP_IDX(quiescent)]			= "quiescent",
+	[SCX_OP_IDX(yield)]			= "yield",
+	[SCX_OP_IDX(core_sched_before)]		= "core_sched_before",
+	[SCX_OP_IDX(set_weight)]		= "set_weight",
+	[SCX_OP_IDX(set_cpumask)]		= "set_cpumask",
+	[SCX_OP_IDX(update_idle)]		= "update_idle",
+	[SCX_OP_IDX(cpu_acquire)]		= "cpu_acquire",
+	[SCX_OP_IDX(cpu_release)]		= "cpu_release",
+	[SCX_OP_IDX(cpu_online)]		= "cpu_online",
+	[SCX_OP_IDX(cpu_offline)]		= "cpu_offline",
+	[SCX_OP_IDX(prep_enable)]		= "prep_enable",
+	[SCX_OP_IDX(enable)]			= "enable",
+	[SCX_OP_IDX(cancel_enable)]		= "cancel_enable",
+	[SCX_OP_IDX(disable)]			= "disable",
+#ifdef CONFIG_EXT_GROUP_SCHED
+	[SCX_OP_IDX(cgroup_init)]		= "cgroup_init",
+	[SCX_OP_IDX(cgroup_exit)]		= "cgroup_exit",
+	[SCX_OP_IDX(cgroup_prep_move)]		= "cgroup_prep_move",
+	[SCX_OP_IDX(cgroup_move)]		= "cgroup_move",
+	[SCX_OP_IDX(cgroup_cancel_move)]	= "cgroup_cancel_move",
+	[SCX_OP_IDX(cgroup_set_weight)]		= "cgroup_set_weight",
+#endif
+	[SCX_OP_IDX(init)]			= "init",
+	[SCX_OP_IDX(exit)]			= "exit",
+};
+
+static void scx_debug_show_op_stats(struct seq_file *m)
+{
+	char buf[40];
+	int i, cpu;
+
+	for (i = 0; i < SCX_NR_OPS; i++) {
+		u64 nr = 0, nsecs = 0;
+
+		if (!((void (**)(void))&scx_ops)[i])
+			continue;
+
+		for_each_possible_cpu(cpu) {
+			struct scx_op_stat *st = per_cpu_ptr(&scx_op_stats[i], cpu);
+
+			nr += READ_ONCE(st->nr);
+			nsecs += READ_ONCE(st->nsecs);
+		}
+
+		snprintf(buf, sizeof(buf), "op.%s", scx_op_names[i]);
+		seq_printf(m, "%-30s: nr=%llu nsecs=%llu\n", buf, nr, nsecs);
+	}
+}
+
+static void scx_debug_show_opss_wait_stats(struct seq_file *m)
+{
+	u64 nr = 0, nsecs = 0, max_nsecs = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct scx_opss_wait_stat *st =
+			per_cpu_ptr(&scx_opss_wait_stats, cpu);
+
+		nr += READ_ONCE(st->nr);
+		nsecs += READ_ONCE(st->nsecs);
+		max_nsecs = max(max_nsecs, READ_ONCE(st->max_nsecs));
+	}
+
+	seq_printf(m, "%-30s: %llu\n", "opss_waits", nr);
+	seq_printf(m, "%-30s: %llu\n", "opss_wait_nsecs", nsecs);
+	seq_printf(m, "%-30s: %llu\n", "opss_wait_max_nsecs", max_nsecs);
+}
+
+static void scx_debug_show_idle_pending_stats(struct seq_file *m)
+{
+	u64 nr = 0, nsecs = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct scx_idle_pending_stat *st =
+			per_cpu_ptr(&scx_idle_pending_stats, cpu);
+
+		nr += READ_ONCE(st->nr);
+		nsecs += READ_ONCE(st->nsecs);
+	}
+
+	seq_printf(m, "%-30s: %llu\n", "idle_pending_waits", nr);
+	seq_printf(m, "%-30s: %llu\n", "idle_pending_nsecs", nsecs);
+	seq_printf(m, "%-30s: %llu\n", "nr_idle_kicks",
+		   atomic64_read(&scx_nr_idle_kicks));
+}
+
 static int scx_debug_show(struct seq_file *m, void *v)
 {
 	mutex_lock(&scx_ops_enable_mutex);
@@ -3416,6 +4253,14 @@ static int scx_debug_show(struct seq_file *m, void *v)
 		   scx_ops_enable_state_str[scx_ops_enable_state()]);
 	seq_printf(m, "%-30s: %llu\n", "nr_rejected",
 		   atomic64_read(&scx_nr_rejected));
+	seq_printf(m, "%-30s: %d\n", "bypassing",
+		   atomic_read(&scx_ops_bypassing));
+	seq_printf(m, "%-30s: %llu\n", "nr_bypasses",
+		   atomic64_read(&scx_nr_bypasses));
+	scx_debug_show_opss_wait_stats(m);
+	scx_debug_show_idle_pending_stats(m);
+	if (static_branch_unlikely(&scx_op_stats_enabled))
+		scx_debug_show_op_stats(m);
 	mutex_unlock(&scx_ops_enable_mutex);
 	return 0;
 }
@@ -3431,6 +4276,92 @@ const struct file_operations sched_ext_fops = {
 	.llseek		= seq_lseek,
 	.release	= single_release,
 };
+
+static ssize_t scx_op_stats_read(struct file *file, char __user *ubuf,
+				 size_t cnt, loff_t *ppos)
+{
+	char buf[2] = { static_key_enabled(&scx_op_stats_enabled) ? '1' : '0',
+			'\n' };
+
+	return simple_read_from_buffer(ubuf, cnt, ppos, buf, sizeof(buf));
+}
+
+/* writing 1 resets the counters and starts collecting, 0 stops */
+static ssize_t scx_op_stats_write(struct file *file, const char __user *ubuf,
+				  size_t cnt, loff_t *ppos)
+{
+	bool enable;
+	int ret, cpu;
+
+	ret = kstrtobool_from_user(ubuf, cnt, &enable);
+	if (ret)
+		return ret;
+
+	mutex_lock(&scx_ops_enable_mutex);
+	if (enable) {
+		static_branch_disable(&scx_op_stats_enabled);
+		for_each_possible_cpu(cpu)
+			memset(per_cpu_ptr(scx_op_stats, cpu), 0,
+			       sizeof(scx_op_stats));
+		static_branch_enable(&scx_op_stats_enabled);
+	} else {
+		static_branch_disable(&scx_op_stats_enabled);
+	}
+	mutex_unlock(&scx_ops_enable_mutex);
+
+	return cnt;
+}
+
+const struct file_operations sched_ext_op_stats_fops = {
+	.read		= scx_op_stats_read,
+	.write		= scx_op_stats_write,
+	.llseek		= default_llseek,
+};
+
+static ssize_t scx_idle_pending_stats_read(struct file *file, char __user *ubuf,
+					   size_t cnt, loff_t *ppos)
+{
+	char buf[2] = { static_key_enabled(&scx_idle_pending_enabled) ? '1' : '0',
+			'\n' };
+
+	return simple_read_from_buffer(ubuf, cnt, ppos, buf, sizeof(buf));
+}
+
+/*
+ * Writing 1 resets the totals and starts tracking, 0 stops. The per-DSQ
+ * counters are cumulative over the lifetime of each DSQ.
+ */
+static ssize_t scx_idle_pending_stats_write(struct file *file,
+					    const char __user *ubuf,
+					    size_t cnt, loff_t *ppos)
+{
+	bool enable;
+	int ret, cpu;
+
+	ret = kstrtobool_from_user(ubuf, cnt, &enable);
+	if (ret)
+		return ret;
+
+	mutex_lock(&scx_ops_enable_mutex);
+	if (enable) {
+		static_branch_disable(&scx_idle_pending_enabled);
+		for_each_possible_cpu(cpu)
+			memset(per_cpu_ptr(&scx_idle_pending_stats, cpu), 0,
+			       sizeof(struct scx_idle_pending_stat));
+		static_branch_enable(&scx_idle_pending_enabled);
+	} else {
+		static_branch_disable(&scx_idle_pending_enabled);
+	}
+	mutex_unlock(&scx_ops_enable_mutex);
+
+	return cnt;
+}
+
+const struct file_operations sched_ext_idle_pending_stats_fops = {
+	.read		= scx_idle_pending_stats_read,
+	.write		= scx_idle_pending_stats_write,
+	.llseek		= default_llseek,
+};
 #endif
 
 /********************************************************************************
@@ -3472,9 +4403,15 @@ static int bpf_scx_btf_struct_access(struct bpf_verifier_log *log,
 		if (off >= offsetof(struct task_struct, scx.dsq_vtime) &&
 		    off + size <= offsetofend(struct task_struct, scx.dsq_vtime))
 			return SCALAR_VALUE;
+		if (off >= offsetof(struct task_struct, scx.dsq_deadline) &&
+		    off + size <= offsetofend(struct task_struct, scx.dsq_deadline))
+			return SCALAR_VALUE;
 		if (off >= offsetof(struct task_struct, scx.disallow) &&
 		    off + size <= offsetofend(struct task_struct, scx.disallow))
 			return SCALAR_VALUE;
+		if (off >= offsetof(struct task_struct, scx.sched_data) &&
+		    off + size <= offsetofend(struct task_struct, scx.sched_data))
+			return SCALAR_VALUE;
 	}
 
 	return 0;
@@ -3519,6 +4456,9 @@ static int bpf_scx_init_member(const struct btf_type *t,
 			return -EINVAL;
 		ops->flags = *(u64 *)(udata + moff);
 		return 1;
+	case offsetof(struct sched_ext_ops, slice_dfl_ns):
+		ops->slice_dfl_ns = *(u64 *)(udata + moff);
+		return 1;
 	case offsetof(struct sched_ext_ops, name):
 		ret = bpf_obj_name_cpy(ops->name, uops->name,
 				       sizeof(ops->name));
@@ -3532,6 +4472,19 @@ static int bpf_scx_init_member(const struct btf_type *t,
 			return -E2BIG;
 		ops->timeout_ms = *(u32 *)(udata + moff);
 		return 1;
+	case offsetof(struct sched_ext_ops, bypass_age_ms):
+		if (*(u32 *)(udata + moff) > SCX_WATCHDOG_MAX_TIMEOUT)
+			return -E2BIG;
+		ops->bypass_age_ms = *(u32 *)(udata + moff);
+		return 1;
+	case offsetof(struct sched_ext_ops, bypass_nr_dsp_exhausts):
+		ops->bypass_nr_dsp_exhausts = *(u32 *)(udata + moff);
+		return 1;
+	case offsetof(struct sched_ext_ops, cpu_ctx_size):
+		if (*(u32 *)(udata + moff) > PAGE_SIZE)
+			return -E2BIG;
+		ops->cpu_ctx_size = *(u32 *)(udata + moff);
+		return 1;
 	}
 
 	return 0;
@@ -3584,16 +4537,79 @@ static int bpf_scx_init(struct btf *btf)
 	return 0;
 }
 
+/*
+ * Hot-swap the operations of the enabled BPF scheduler with the ones in @kdata,
+ * e.g. to switch to programs which were re-loaded with different rodata
+ * constants. Re-registering can always fail in ops.init(), ops.prep_enable()
+ * and so on, so the new ops must be a drop-in replacement instead: the same
+ * set of operations must be implemented and all the non-operation fields -
+ * flags, timeouts, name and so on - must be identical. ops.init() is not
+ * called. The BPF maps and DSQs are left as-is and the new programs should
+ * share the maps of the old ones.
+ */
 static int bpf_scx_update(void *kdata, void *old_kdata)
 {
+	const size_t ops_sz = offsetof(struct sched_ext_ops, dispatch_max_batch);
+	void (**new_ops)(void) = kdata;
+	void (**old_ops)(void) = old_kdata;
+	void (**cur_ops)(void) = (void *)&scx_ops;
+	int i, ret = 0;
+
+	BUILD_BUG_ON(ops_sz != SCX_NR_OPS * sizeof(void (*)(void)));
+
+	mutex_lock(&scx_ops_enable_mutex);
+
+	/* @old_kdata must be the currently enabled scheduler */
+	if (scx_ops_enable_state() != SCX_OPS_ENABLED ||
+	    memcmp(&scx_ops, old_kdata, sizeof(scx_ops))) {
+		ret = -EBUSY;
+		goto out_unlock;
+	}
+
+	for (i = 0; i < SCX_NR_OPS; i++) {
+		if (!new_ops[i] != !cur_ops[i]) {
+			ret = -EINVAL;
+			goto out_unlock;
+		}
+	}
+
+	if (memcmp(kdata + ops_sz, (void *)&scx_ops + ops_sz,
+		   sizeof(scx_ops) - ops_sz)) {
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+
+	/*
+	 * Sleepable operations are only called with either the fork or cgroup
+	 * rwsem read-locked. Lock both out while swapping the operations.
+	 */
+	percpu_down_write(&scx_fork_rwsem);
+	scx_cgroup_lock();
+
+	/*
+	 * scx_ops_disable_workfn() doesn't grab scx_ops_enable_mutex before
+	 * installing the fallback ops.enqueue() and .dispatch(), so the state
+	 * may have turned DISABLING since the check above. Swap each op with
+	 * cmpxchg() against @old_kdata so that the fallbacks, and the
+	 * clearing of scx_ops at the end of disabling, are never overwritten.
+	 * Once an op may have been swapped, the new programs may be in use and
+	 * the update can't fail anymore. Disabling takes care of the rest.
+	 */
+	for (i = 0; i < SCX_NR_OPS; i++)
+		cmpxchg(&cur_ops[i], old_ops[i], new_ops[i]);
+
+	scx_cgroup_unlock();
+	percpu_up_write(&scx_fork_rwsem);
+
 	/*
-	 * sched_ext does not support updating the actively-loaded BPF
-	 * scheduler, as registering a BPF scheduler can always fail if the
-	 * scheduler returns an error code for e.g. ops.init(),
-	 * ops.prep_enable(), etc. Similarly, we can always race with
-	 * unregistration happening elsewhere, such as with sysrq.
+	 * All other operations are called from non-preemptible contexts. Wait
+	 * for them so that the old programs are guaranteed to be done when the
+	 * update returns and the caller can e.g. hand off state.
 	 */
-	return -EOPNOTSUPP;
+	synchronize_rcu();
+out_unlock:
+	mutex_unlock(&scx_ops_enable_mutex);
+	return ret;
 }
 
 static int bpf_scx_validate(void *kdata)
@@ -3678,7 +4694,7 @@ static void kick_cpus_irq_workfn(struct irq_work *irq_work)
 
 void __init init_sched_ext_class(void)
 {
-	int cpu;
+	int i, cpu;
 	u32 v;
 
 	/*
@@ -3695,6 +4711,8 @@ void __init init_sched_ext_class(void)
 	BUG_ON(!alloc_cpumask_var(&idle_masks.cpu, GFP_KERNEL));
 	BUG_ON(!alloc_cpumask_var(&idle_masks.smt, GFP_KERNEL));
 #endif
+	for (i = 0; i < SCX_NR_AFFN_CLASSES; i++)
+		BUG_ON(!zalloc_cpumask_var(&scx_affn_masks[i], GFP_KERNEL));
 	scx_kick_cpus_pnt_seqs =
 		__alloc_percpu(sizeof(scx_kick_cpus_pnt_seqs[0]) *
 			       num_possible_cpus(),
@@ -3715,6 +4733,7 @@ void __init init_sched_ext_class(void)
 
 	register_sysrq_key('S', &sysrq_sched_ext_reset_op);
 	INIT_DELAYED_WORK(&scx_watchdog_work, scx_watchdog_workfn);
+	INIT_DELAYED_WORK(&scx_bypass_work, scx_bypass_workfn);
 	scx_cgroup_config_knobs();
 }
 
@@ -3753,14 +4772,24 @@ static const struct btf_kfunc_id_set scx_kfunc_set_init = {
 };
 
 /**
- * scx_bpf_create_dsq - Create a custom DSQ
+ * scx_bpf_create_dsq_flags - Create a custom DSQ with a length limit and flags
  * @dsq_id: DSQ to create
  * @node: NUMA node to allocate from
+ * @max_nr: high watermark on the number of queued tasks, 0 for unlimited
+ * @flags: %SCX_DSQ_* creation flags
  *
  * Create a custom DSQ identified by @dsq_id. Can be called from ops.init(),
  * ops.prep_enable(), ops.cgroup_init() and ops.cgroup_prep_move().
+ *
+ * The DSQ is considered full once @max_nr or more tasks are queued on it. The
+ * limit isn't enforced on regular dispatches as the tasks must be queued
+ * somewhere. Instead, scx_bpf_dispatch_capped() fails while the DSQ is full so
+ * that the BPF scheduler can spill the task to another DSQ.
+ *
+ * @flags select how the DSQ behaves. %SCX_DSQ_ORDER_EDF orders the priority
+ * queue by p->scx.dsq_deadline with p->scx.dsq_vtime as the tie-break.
  */
-s32 scx_bpf_create_dsq(u64 dsq_id, s32 node)
+s32 scx_bpf_create_dsq_flags(u64 dsq_id, s32 node, u32 max_nr, u64 flags)
 {
 	if (!scx_kf_allowed(SCX_KF_INIT | SCX_KF_SLEEPABLE))
 		return -EINVAL;
@@ -3768,11 +4797,25 @@ s32 scx_bpf_create_dsq(u64 dsq_id, s32 node)
 	if (unlikely(node >= (int)nr_node_ids ||
 		     (node < 0 && node != NUMA_NO_NODE)))
 		return -EINVAL;
-	return PTR_ERR_OR_ZERO(create_dsq(dsq_id, node));
+	return PTR_ERR_OR_ZERO(create_dsq(dsq_id, node, max_nr, flags));
+}
+
+/**
+ * scx_bpf_create_dsq - Create a custom DSQ
+ * @dsq_id: DSQ to create
+ * @node: NUMA node to allocate from
+ *
+ * Create an unlimited custom DSQ identified by @dsq_id with the default
+ * behavior. See scx_bpf_create_dsq_flags().
+ */
+s32 scx_bpf_create_dsq(u64 dsq_id, s32 node)
+{
+	return scx_bpf_create_dsq_flags(dsq_id, node, 0, 0);
 }
 
 BTF_SET8_START(scx_kfunc_ids_sleepable)
 BTF_ID_FLAGS(func, scx_bpf_create_dsq, KF_SLEEPABLE)
+BTF_ID_FLAGS(func, scx_bpf_create_dsq_flags, KF_SLEEPABLE)
 BTF_SET8_END(scx_kfunc_ids_sleepable)
 
 static const struct btf_kfunc_id_set scx_kfunc_set_sleepable = {
@@ -3885,6 +4928,13 @@ void scx_bpf_dispatch(struct task_struct *p, u64 dsq_id, u64 slice,
  * @vtime ordering is according to time_before64() which considers wrapping. A
  * numerically larger vtime may indicate an earlier position in the ordering and
  * vice-versa.
+ *
+ * Local DSQs can be vtime ordered too. Tasks consumed from the priority queue
+ * of a non-local DSQ land on the priority queue of the local DSQ and
+ * %SCX_ENQ_PREEMPT_IF_EARLIER can be used to preempt the current task only if
+ * @vtime is before the current task's p->scx.dsq_vtime and @p is going to run
+ * next, i.e. the local FIFO is empty and @p is at the head of the local
+ * priority queue.
  */
 void scx_bpf_dispatch_vtime(struct task_struct *p, u64 dsq_id, u64 slice,
 			    u64 vtime, u64 enq_flags)
@@ -3902,32 +4952,120 @@ void scx_bpf_dispatch_vtime(struct task_struct *p, u64 dsq_id, u64 slice,
 	scx_dispatch_commit(p, dsq_id, enq_flags | SCX_ENQ_DSQ_PRIQ);
 }
 
-BTF_SET8_START(scx_kfunc_ids_enqueue_dispatch)
-BTF_ID_FLAGS(func, scx_bpf_dispatch, KF_RCU)
-BTF_ID_FLAGS(func, scx_bpf_dispatch_vtime, KF_RCU)
-BTF_SET8_END(scx_kfunc_ids_enqueue_dispatch)
-
-static const struct btf_kfunc_id_set scx_kfunc_set_enqueue_dispatch = {
-	.owner			= THIS_MODULE,
-	.set			= &scx_kfunc_ids_enqueue_dispatch,
-};
-
 /**
- * scx_bpf_dispatch_nr_slots - Return the number of remaining dispatch slots
+ * scx_bpf_dispatch_edf - Dispatch a task into the EDF priority queue of a DSQ
+ * @p: task_struct to dispatch
+ * @dsq_id: DSQ to dispatch to
+ * @deadline: @p's primary ordering key
+ * @vtime: @p's secondary ordering key, breaks ties in @deadline
+ * @enq_flags: SCX_ENQ_*
  *
- * Can only be called from ops.dispatch().
+ * Dispatch @p into the priority queue of the DSQ identified by @dsq_id. If
+ * the DSQ was created with %SCX_DSQ_ORDER_EDF, tasks are ordered by @deadline
+ * and then by @vtime. Otherwise, @deadline is ignored and this is identical
+ * to scx_bpf_dispatch_vtime(). Local DSQs are always ordered by @vtime only.
+ *
+ * Both keys are compared with time_before64(). BPF kfuncs are limited to five
+ * arguments, so unlike scx_bpf_dispatch_vtime(), this function doesn't take
+ * a slice. @p keeps its current p->scx.slice, which the BPF scheduler can set
+ * directly before calling this function. If p->scx.slice is zero, it's set to
+ * the smallest slice as with scx_bpf_dispatch().
  */
-u32 scx_bpf_dispatch_nr_slots(void)
+void scx_bpf_dispatch_edf(struct task_struct *p, u64 dsq_id, u64 deadline,
+			  u64 vtime, u64 enq_flags)
 {
-	if (!scx_kf_allowed(SCX_KF_DISPATCH))
-		return 0;
+	if (!scx_dispatch_preamble(p, enq_flags))
+		return;
 
-	return scx_dsp_max_batch - __this_cpu_read(scx_dsp_ctx.buf_cursor);
+	p->scx.slice = p->scx.slice ?: 1;
+	p->scx.dsq_deadline = deadline;
+	p->scx.dsq_vtime = vtime;
+
+	scx_dispatch_commit(p, dsq_id, enq_flags | SCX_ENQ_DSQ_PRIQ);
+}
+
+static bool dsq_id_over_limit(u64 dsq_id)
+{
+	struct scx_dispatch_q *dsq;
+	u32 max_nr;
+
+	if (dsq_id & SCX_DSQ_FLAG_BUILTIN)
+		return false;
+
+	dsq = find_non_local_dsq(dsq_id);
+	if (!dsq)
+		return false;
+
+	max_nr = READ_ONCE(dsq->max_nr);
+	return max_nr && READ_ONCE(dsq->nr) >= max_nr;
 }
 
 /**
- * scx_bpf_consume - Transfer a task from a DSQ to the current CPU's local DSQ
- * @dsq_id: DSQ to consume
+ * scx_bpf_dispatch_capped - Dispatch a task into a DSQ unless it's full
+ * @p: task_struct to dispatch
+ * @dsq_id: DSQ to dispatch to
+ * @slice: duration @p can run for in nsecs
+ * @enq_flags: SCX_ENQ_*
+ *
+ * Identical to scx_bpf_dispatch() except that, if @dsq_id was created with
+ * scx_bpf_create_dsq_flags() and is at or above its high watermark, @p is
+ * not dispatched and -%EBUSY is returned. The BPF scheduler can then dispatch
+ * @p elsewhere. Built-in DSQs are never considered full.
+ *
+ * The check is racy against concurrent dispatches and consumptions and the
+ * watermark may be overshot by the number of CPUs dispatching concurrently.
+ * Also, when called from ops.dispatch(), tasks which are still in the
+ * dispatch buffer aren't counted.
+ *
+ * Returns 0 if @p was dispatched, -%EBUSY if @dsq_id is full, -%EINVAL if
+ * the dispatch was rejected.
+ */
+s32 scx_bpf_dispatch_capped(struct task_struct *p, u64 dsq_id, u64 slice,
+			    u64 enq_flags)
+{
+	if (!scx_dispatch_preamble(p, enq_flags))
+		return -EINVAL;
+
+	if (dsq_id_over_limit(dsq_id))
+		return -EBUSY;
+
+	if (slice)
+		p->scx.slice = slice;
+	else
+		p->scx.slice = p->scx.slice ?: 1;
+
+	scx_dispatch_commit(p, dsq_id, enq_flags);
+	return 0;
+}
+
+BTF_SET8_START(scx_kfunc_ids_enqueue_dispatch)
+BTF_ID_FLAGS(func, scx_bpf_dispatch, KF_RCU)
+BTF_ID_FLAGS(func, scx_bpf_dispatch_vtime, KF_RCU)
+BTF_ID_FLAGS(func, scx_bpf_dispatch_edf, KF_RCU)
+BTF_ID_FLAGS(func, scx_bpf_dispatch_capped, KF_RCU)
+BTF_SET8_END(scx_kfunc_ids_enqueue_dispatch)
+
+static const struct btf_kfunc_id_set scx_kfunc_set_enqueue_dispatch = {
+	.owner			= THIS_MODULE,
+	.set			= &scx_kfunc_ids_enqueue_dispatch,
+};
+
+/**
+ * scx_bpf_dispatch_nr_slots - Return the number of remaining dispatch slots
+ *
+ * Can only be called from ops.dispatch().
+ */
+u32 scx_bpf_dispatch_nr_slots(void)
+{
+	if (!scx_kf_allowed(SCX_KF_DISPATCH))
+		return 0;
+
+	return scx_dsp_max_batch - __this_cpu_read(scx_dsp_ctx.buf_cursor);
+}
+
+/**
+ * scx_bpf_consume - Transfer a task from a DSQ to the current CPU's local DSQ
+ * @dsq_id: DSQ to consume
  *
  * Consume a task from the non-local DSQ identified by @dsq_id and transfer it
  * to the current CPU's local DSQ for execution. Can only be called from
@@ -3956,7 +5094,7 @@ bool scx_bpf_consume(u64 dsq_id)
 		return false;
 	}
 
-	if (consume_dispatch_q(dspc->rq, dspc->rf, dsq)) {
+	if (consume_dispatch_q(dspc->rq, dspc->rf, dsq, 0)) {
 		/*
 		 * A successfully consumed task can be dequeued before it starts
 		 * running while the CPU is trying to migrate other dispatched
@@ -3970,9 +5108,98 @@ bool scx_bpf_consume(u64 dsq_id)
 	}
 }
 
+/**
+ * scx_bpf_consume_if_head - Consume the head task of a DSQ if it's unchanged
+ * @dsq_id: DSQ to consume
+ * @seq: enqueue sequence number of the expected head task, from
+ *	 scx_dsq_peek_info->seq filled by scx_bpf_dsq_peek()
+ *
+ * Like scx_bpf_consume() but only the head task of the DSQ is considered and
+ * it's consumed only if it's still the same enqueue instance identified by
+ * @seq and it can run on the current CPU. A task which was consumed and then
+ * queued back on the DSQ gets a new sequence number and doesn't match.
+ * Combined with scx_bpf_dsq_peek(), this allows picking between the heads of
+ * multiple DSQs without shadow bookkeeping on the BPF side. Can only be called
+ * from ops.dispatch().
+ *
+ * Returns %true if the head task has been consumed, %false otherwise.
+ */
+bool scx_bpf_consume_if_head(u64 dsq_id, u64 seq)
+{
+	struct scx_dsp_ctx *dspc = this_cpu_ptr(&scx_dsp_ctx);
+	struct scx_dispatch_q *dsq;
+
+	if (!scx_kf_allowed(SCX_KF_DISPATCH))
+		return false;
+
+	if (unlikely(!seq)) {
+		scx_ops_error("invalid DSQ sequence number 0");
+		return false;
+	}
+
+	flush_dispatch_buf(dspc->rq, dspc->rf);
+
+	dsq = find_non_local_dsq(dsq_id);
+	if (unlikely(!dsq)) {
+		scx_ops_error("invalid DSQ ID 0x%016llx", dsq_id);
+		return false;
+	}
+
+	if (consume_dispatch_q(dspc->rq, dspc->rf, dsq, seq)) {
+		/* see scx_bpf_consume() */
+		dspc->nr_tasks++;
+		return true;
+	} else {
+		return false;
+	}
+}
+
+#ifdef CONFIG_EXT_GROUP_SCHED
+/**
+ * scx_bpf_consume_cgroup - Transfer a task from a cgroup's DSQ to the current
+ * CPU's local DSQ
+ * @cgrp: cgroup whose DSQ to consume
+ *
+ * Like scx_bpf_consume() but consumes the DSQ attached to @cgrp with
+ * %SCX_OPS_CGROUP_DSQ. @cgrp must have the CPU controller enabled. Can only be
+ * called from ops.dispatch().
+ *
+ * Returns %true if a task has been consumed, %false if there isn't any task to
+ * consume.
+ */
+bool scx_bpf_consume_cgroup(struct cgroup *cgrp)
+{
+	struct scx_dsp_ctx *dspc = this_cpu_ptr(&scx_dsp_ctx);
+	struct scx_dispatch_q *dsq;
+
+	if (!scx_kf_allowed(SCX_KF_DISPATCH))
+		return false;
+
+	flush_dispatch_buf(dspc->rq, dspc->rf);
+
+	dsq = cgroup_dsq(cgrp);
+	if (unlikely(!dsq)) {
+		scx_ops_error("no DSQ attached to cgroup %llu", cgroup_id(cgrp));
+		return false;
+	}
+
+	if (consume_dispatch_q(dspc->rq, dspc->rf, dsq, 0)) {
+		/* see scx_bpf_consume() */
+		dspc->nr_tasks++;
+		return true;
+	} else {
+		return false;
+	}
+}
+#endif
+
 BTF_SET8_START(scx_kfunc_ids_dispatch)
 BTF_ID_FLAGS(func, scx_bpf_dispatch_nr_slots)
 BTF_ID_FLAGS(func, scx_bpf_consume)
+BTF_ID_FLAGS(func, scx_bpf_consume_if_head)
+#ifdef CONFIG_EXT_GROUP_SCHED
+BTF_ID_FLAGS(func, scx_bpf_consume_cgroup, KF_RCU)
+#endif
 BTF_SET8_END(scx_kfunc_ids_dispatch)
 
 static const struct btf_kfunc_id_set scx_kfunc_set_dispatch = {
@@ -4096,6 +5323,63 @@ s32 scx_bpf_dsq_nr_queued(u64 dsq_id)
 	return -ENOENT;
 }
 
+#ifdef CONFIG_EXT_GROUP_SCHED
+/**
+ * scx_bpf_cgroup_dsq_nr_queued - Return the number of tasks queued on a
+ * cgroup's DSQ
+ * @cgrp: cgroup of interest
+ *
+ * Return the number of tasks in the DSQ attached to @cgrp with
+ * %SCX_OPS_CGROUP_DSQ. If @cgrp doesn't have one, -%ENOENT is returned. Can be
+ * called from any non-sleepable online scx_ops operations.
+ */
+s32 scx_bpf_cgroup_dsq_nr_queued(struct cgroup *cgrp)
+{
+	struct scx_dispatch_q *dsq = cgroup_dsq(cgrp);
+
+	return dsq ? READ_ONCE(dsq->nr) : -ENOENT;
+}
+#endif
+
+/**
+ * scx_bpf_dsq_peek - Look at the head task of a DSQ without consuming it
+ * @dsq_id: id of the non-local DSQ to peek
+ * @info: out parameter, filled with the head task's information
+ *
+ * Fill @info with the ordering keys, runnable timestamp, enqueue sequence
+ * number and pid of the task that scx_bpf_consume() would look at first on the
+ * DSQ matching @dsq_id. The task may be consumed by another CPU right after
+ * this function returns. Use scx_bpf_consume_if_head() with @info->seq to
+ * consume it only if it's still at the head. Can be called from any
+ * non-sleepable online scx_ops operations.
+ *
+ * Returns 0 on success, -%ENODATA if the DSQ is empty and -%ENOENT if the DSQ
+ * doesn't exist or is a local DSQ.
+ */
+s32 scx_bpf_dsq_peek(u64 dsq_id, struct scx_dsq_peek_info *info)
+{
+	struct scx_dispatch_q *dsq;
+	unsigned long flags;
+	s32 ret = -ENODATA;
+
+	lockdep_assert(rcu_read_lock_any_held());
+
+	if (dsq_id == SCX_DSQ_LOCAL ||
+	    (dsq_id & SCX_DSQ_LOCAL_ON) == SCX_DSQ_LOCAL_ON)
+		return -ENOENT;
+
+	dsq = find_non_local_dsq(dsq_id);
+	if (!dsq)
+		return -ENOENT;
+
+	raw_spin_lock_irqsave(&dsq->lock, flags);
+	if (peek_dsq_head(dsq, info))
+		ret = 0;
+	raw_spin_unlock_irqrestore(&dsq->lock, flags);
+
+	return ret;
+}
+
 /**
  * scx_bpf_test_and_clear_cpu_idle - Test and clear @cpu's idle state
  * @cpu: cpu to test and clear idle for
@@ -4330,6 +5614,124 @@ s32 scx_bpf_task_cpu(const struct task_struct *p)
 	return task_cpu(p);
 }
 
+/**
+ * scx_bpf_task_since_ran - Nsecs since a task last ran
+ * @p: task of interest
+ *
+ * Return the number of nsecs since @p last stopped running, 0 if @p is
+ * currently running. Combined with scx_bpf_task_cpu() and scx_bpf_cpu_llc_id(),
+ * this can be used to estimate how cache-hot @p is on its previous CPU. The
+ * value is read locklessly and should only be used as a hint.
+ */
+u64 scx_bpf_task_since_ran(const struct task_struct *p)
+{
+	return task_since_ran(p);
+}
+
+/**
+ * scx_bpf_task_cache_hot - Is a task likely cache-hot w.r.t. a CPU?
+ * @p: task of interest
+ * @cpu: CPU @p may be moved to
+ *
+ * Return %true if @p last ran on a CPU which doesn't share the LLC with @cpu
+ * less than sysctl_sched_migration_cost ago, which is the same test that
+ * %SCX_OPS_CONSUME_COLD_FIRST uses when consuming DSQs.
+ */
+bool scx_bpf_task_cache_hot(const struct task_struct *p, s32 cpu)
+{
+	if (!ops_cpu_valid(cpu)) {
+		scx_ops_error("invalid cpu %d", cpu);
+		return false;
+	}
+
+	return task_cache_hot(p, cpu);
+}
+
+/**
+ * scx_bpf_cpu_llc_id - Return the ID of the LLC domain a CPU belongs to
+ * @cpu: CPU of interest
+ *
+ * CPUs which share the last level cache have the same ID. Returns -%EINVAL if
+ * @cpu is invalid.
+ */
+s32 scx_bpf_cpu_llc_id(s32 cpu)
+{
+	if (!ops_cpu_valid(cpu)) {
+		scx_ops_error("invalid cpu %d", cpu);
+		return -EINVAL;
+	}
+
+#ifdef CONFIG_SMP
+	return per_cpu(sd_llc_id, cpu);
+#else
+	return 0;
+#endif
+}
+
+/**
+ * scx_bpf_cpu_ctx - Return the context area of a CPU
+ * @cpu: CPU of interest
+ * @rdwr_buf_size: number of bytes to access, must be a constant
+ *
+ * Return @cpu's context area, see sched_ext_ops.cpu_ctx_size. The area stays
+ * valid while the BPF scheduler is loaded. Synchronizing accesses from
+ * different CPUs is up to the BPF scheduler. Returns %NULL and triggers an
+ * error if @cpu is invalid or @rdwr_buf_size is larger than the area.
+ */
+void *scx_bpf_cpu_ctx(s32 cpu, const int rdwr_buf_size)
+{
+	if (!ops_cpu_valid(cpu)) {
+		scx_ops_error("invalid cpu %d", cpu);
+		return NULL;
+	}
+
+	if ((u32)rdwr_buf_size > scx_ops.cpu_ctx_size) {
+		scx_ops_error("cpu_ctx access size %d larger than cpu_ctx_size %u",
+			      rdwr_buf_size, scx_ops.cpu_ctx_size);
+		return NULL;
+	}
+
+	return READ_ONCE(cpu_rq(cpu)->scx.cpu_ctx);
+}
+
+/**
+ * scx_bpf_nr_affn_classes - Return the number of affinity classes
+ *
+ * Affinity classes are numbered from 0 and the number only grows while the
+ * BPF scheduler is loaded, see sched_ext_entity->affn_class.
+ */
+u32 scx_bpf_nr_affn_classes(void)
+{
+	return smp_load_acquire(&scx_nr_affn_classes);
+}
+
+/**
+ * scx_bpf_get_affn_class_cpumask - Get a referenced kptr to the cpumask of an
+ * affinity class
+ * @class_id: affinity class, usually @p->scx.affn_class
+ *
+ * The cpumask doesn't change while the BPF scheduler is loaded. Returns an
+ * empty cpumask if @class_id is %SCX_AFFN_CLASS_NONE or invalid. Must be
+ * released with scx_bpf_put_cpumask().
+ */
+const struct cpumask *scx_bpf_get_affn_class_cpumask(u32 class_id)
+{
+	if (class_id >= scx_bpf_nr_affn_classes())
+		return cpu_none_mask;
+
+	return scx_affn_masks[class_id];
+}
+
+/**
+ * scx_bpf_put_cpumask - Release a cpumask acquired with
+ * scx_bpf_get_affn_class_cpumask()
+ * @cpumask: cpumask to release
+ */
+void scx_bpf_put_cpumask(const struct cpumask *cpumask)
+{
+	/* see scx_bpf_put_idle_cpumask() */
+}
+
 /**
  * scx_bpf_task_cgroup - Return the sched cgroup of a task
  * @p: task of interest
@@ -4368,6 +5770,7 @@ struct cgroup *scx_bpf_task_cgroup(struct task_struct *p)
 BTF_SET8_START(scx_kfunc_ids_any)
 BTF_ID_FLAGS(func, scx_bpf_kick_cpu)
 BTF_ID_FLAGS(func, scx_bpf_dsq_nr_queued)
+BTF_ID_FLAGS(func, scx_bpf_dsq_peek)
 BTF_ID_FLAGS(func, scx_bpf_test_and_clear_cpu_idle)
 BTF_ID_FLAGS(func, scx_bpf_pick_idle_cpu, KF_RCU)
 BTF_ID_FLAGS(func, scx_bpf_pick_any_cpu, KF_RCU)
@@ -4378,9 +5781,19 @@ BTF_ID_FLAGS(func, scx_bpf_error_bstr, KF_TRUSTED_ARGS)
 BTF_ID_FLAGS(func, scx_bpf_destroy_dsq)
 BTF_ID_FLAGS(func, scx_bpf_task_running, KF_RCU)
 BTF_ID_FLAGS(func, scx_bpf_task_cpu, KF_RCU)
+BTF_ID_FLAGS(func, scx_bpf_task_since_ran, KF_RCU)
+BTF_ID_FLAGS(func, scx_bpf_task_cache_hot, KF_RCU)
+BTF_ID_FLAGS(func, scx_bpf_cpu_llc_id)
+BTF_ID_FLAGS(func, scx_bpf_cpu_ctx, KF_RET_NULL)
+BTF_ID_FLAGS(func, scx_bpf_nr_affn_classes)
+BTF_ID_FLAGS(func, scx_bpf_get_affn_class_cpumask, KF_ACQUIRE)
+BTF_ID_FLAGS(func, scx_bpf_put_cpumask, KF_RELEASE)
 #ifdef CONFIG_CGROUP_SCHED
 BTF_ID_FLAGS(func, scx_bpf_task_cgroup, KF_RCU | KF_ACQUIRE)
 #endif
+#ifdef CONFIG_EXT_GROUP_SCHED
+BTF_ID_FLAGS(func, scx_bpf_cgroup_dsq_nr_queued, KF_RCU)
+#endif
 BTF_SET8_END(scx_kfunc_ids_any)
 
 static const struct btf_kfunc_id_set scx_kfunc_set_any = {
@@ -4425,3 +5838,392 @@ static int __init register_ext_kfuncs(void)
 	return 0;
 }
 __initcall(register_ext_kfuncs);
+
+/*
+ * bpf_iter targets which walk the tasks on sched_ext and the DSQs, allowing
+ * userspace to snapshot the scheduler state with a single read() instead of
+ * per-task map lookups or /proc walks. The objects are visited one by one
+ * without a global lock, so the snapshot isn't atomic.
+ */
+struct bpf_iter__sched_ext_task {
+	__bpf_md_ptr(struct bpf_iter_meta *, meta);
+	__bpf_md_ptr(struct task_struct *, task);
+};
+
+DEFINE_BPF_ITER_FUNC(sched_ext_task, struct bpf_iter_meta *meta,
+		     struct task_struct *task)
+
+struct bpf_iter_scx_task_priv {
+	struct scx_task_iter	iter;
+	struct task_struct	*cur;	/* last returned task, see seq_stop */
+};
+
+static struct task_struct *scx_task_seq_get_next(struct bpf_iter_scx_task_priv *priv)
+{
+	struct task_struct *p;
+
+	spin_lock_irq(&scx_tasks_lock);
+	while ((p = scx_task_iter_next_filtered(&priv->iter))) {
+		/* @p may be on scx_tasks with zero usage until sched_ext_free() */
+		if (p->sched_class == &ext_sched_class &&
+		    refcount_inc_not_zero(&p->usage))
+			break;
+	}
+	spin_unlock_irq(&scx_tasks_lock);
+
+	priv->cur = p;
+	return p;
+}
+
+static void *scx_task_seq_start(struct seq_file *seq, loff_t *pos)
+{
+	struct bpf_iter_scx_task_priv *priv = seq->private;
+	struct task_struct *p;
+
+	/* resume from the task which didn't fit in the last read() */
+	p = priv->cur ?: scx_task_seq_get_next(priv);
+	if (p && *pos == 0)
+		++*pos;
+	return p;
+}
+
+static void *scx_task_seq_next(struct seq_file *seq, void *v, loff_t *pos)
+{
+	struct bpf_iter_scx_task_priv *priv = seq->private;
+
+	++*pos;
+	put_task_struct(v);
+	return scx_task_seq_get_next(priv);
+}
+
+static int __scx_task_seq_show(struct seq_file *seq, void *v, bool in_stop)
+{
+	struct bpf_iter__sched_ext_task ctx;
+	struct bpf_iter_meta meta;
+	struct bpf_prog *prog;
+
+	meta.seq = seq;
+	prog = bpf_iter_get_info(&meta, in_stop);
+	if (!prog)
+		return 0;
+
+	ctx.meta = &meta;
+	ctx.task = v;
+	return bpf_iter_run_prog(prog, &ctx);
+}
+
+static int scx_task_seq_show(struct seq_file *seq, void *v)
+{
+	return __scx_task_seq_show(seq, v, false);
+}
+
+static void scx_task_seq_stop(struct seq_file *seq, void *v)
+{
+	/* if @v is not NULL, it's kept in ->cur and shown on the next start */
+	if (!v)
+		(void)__scx_task_seq_show(seq, v, true);
+}
+
+static int scx_task_seq_init(void *priv_data, struct bpf_iter_aux_info *aux)
+{
+	struct bpf_iter_scx_task_priv *priv = priv_data;
+
+	spin_lock_irq(&scx_tasks_lock);
+	scx_task_iter_init(&priv->iter);
+	spin_unlock_irq(&scx_tasks_lock);
+	priv->cur = NULL;
+	return 0;
+}
+
+static void scx_task_seq_fini(void *priv_data)
+{
+	struct bpf_iter_scx_task_priv *priv = priv_data;
+
+	spin_lock_irq(&scx_tasks_lock);
+	scx_task_iter_exit(&priv->iter);
+	spin_unlock_irq(&scx_tasks_lock);
+	if (priv->cur)
+		put_task_struct(priv->cur);
+}
+
+static const struct seq_operations scx_task_seq_ops = {
+	.start	= scx_task_seq_start,
+	.next	= scx_task_seq_next,
+	.stop	= scx_task_seq_stop,
+	.show	= scx_task_seq_show,
+};
+
+static const struct bpf_iter_seq_info scx_task_seq_info = {
+	.seq_ops		= &scx_task_seq_ops,
+	.init_seq_private	= scx_task_seq_init,
+	.fini_seq_private	= scx_task_seq_fini,
+	.seq_priv_size		= sizeof(struct bpf_iter_scx_task_priv),
+};
+
+static struct bpf_iter_reg scx_task_reg_info = {
+	.target			= "sched_ext_task",
+	.feature		= BPF_ITER_RESCHED,
+	.ctx_arg_info_size	= 1,
+	.ctx_arg_info		= {
+		{ offsetof(struct bpf_iter__sched_ext_task, task),
+		  PTR_TO_BTF_ID_OR_NULL },
+	},
+	.seq_info		= &scx_task_seq_info,
+};
+
+/*
+ * @head is %NULL if the DSQ is empty. Otherwise, it describes the task which
+ * would be consumed first, see scx_bpf_dsq_peek().
+ */
+struct bpf_iter__sched_ext_dsq {
+	__bpf_md_ptr(struct bpf_iter_meta *, meta);
+	__bpf_md_ptr(struct scx_dispatch_q *, dsq);
+	__bpf_md_ptr(struct scx_dsq_peek_info *, head);
+};
+
+DEFINE_BPF_ITER_FUNC(sched_ext_dsq, struct bpf_iter_meta *meta,
+		     struct scx_dispatch_q *dsq, struct scx_dsq_peek_info *head)
+
+/*
+ * DSQs are visited in the order of the global DSQ (@cpu == -1), the local DSQs
+ * of the possible CPUs, the user DSQs in dsq_hash (@cpu >= nr_cpu_ids) and the
+ * cgroup DSQs of %SCX_OPS_CGROUP_DSQ, which aren't on dsq_hash. The last two
+ * steps are protected by RCU which is held between seq_start and seq_stop.
+ * Across read()'s, the cgroup walk is resumed from @css which is pinned.
+ */
+struct bpf_iter_scx_dsq_priv {
+	struct rhashtable_iter	rht_iter;
+	int			cpu;
+	bool			rht_started;
+	bool			rht_done;
+#ifdef CONFIG_EXT_GROUP_SCHED
+	struct cgroup_subsys_state *css;
+	bool			cgrp_done;
+#endif
+};
+
+#ifdef CONFIG_EXT_GROUP_SCHED
+static struct scx_dispatch_q *
+scx_dsq_seq_get_cgroup(struct bpf_iter_scx_dsq_priv *priv, bool advance)
+{
+	struct cgroup_subsys_state *pos = priv->css;
+	struct scx_dispatch_q *dsq;
+
+	if (priv->cgrp_done)
+		return NULL;
+
+	if (pos && !advance) {
+		dsq = rcu_dereference(css_tg(pos)->scx_dsq);
+		if (dsq)
+			return dsq;
+	}
+
+	while ((pos = css_next_descendant_pre(pos, &root_task_group.css))) {
+		dsq = rcu_dereference(css_tg(pos)->scx_dsq);
+		if (dsq && css_tryget(pos)) {
+			if (priv->css)
+				css_put(priv->css);
+			priv->css = pos;
+			return dsq;
+		}
+	}
+
+	if (priv->css) {
+		css_put(priv->css);
+		priv->css = NULL;
+	}
+	priv->cgrp_done = true;
+	return NULL;
+}
+#else
+static struct scx_dispatch_q *
+scx_dsq_seq_get_cgroup(struct bpf_iter_scx_dsq_priv *priv, bool advance)
+{
+	return NULL;
+}
+#endif
+
+static struct scx_dispatch_q *scx_dsq_seq_get(struct bpf_iter_scx_dsq_priv *priv,
+					      bool advance)
+{
+	struct scx_dispatch_q *dsq;
+
+	if (priv->cpu < 0) {
+		if (!advance)
+			return &scx_dsq_global;
+		priv->cpu = cpumask_first(cpu_possible_mask);
+	} else if (priv->cpu < nr_cpu_ids && advance) {
+		priv->cpu = cpumask_next(priv->cpu, cpu_possible_mask);
+	}
+
+	if (priv->cpu < nr_cpu_ids)
+		return &cpu_rq(priv->cpu)->scx.local_dsq;
+
+	if (priv->rht_done)
+		return scx_dsq_seq_get_cgroup(priv, advance);
+
+	/*
+	 * On a resize, the walk restarts from the beginning of the table and
+	 * some DSQs may be visited more than once.
+	 */
+	do {
+		if (advance || !priv->rht_started)
+			dsq = rhashtable_walk_next(&priv->rht_iter);
+		else
+			dsq = rhashtable_walk_peek(&priv->rht_iter);
+	} while (dsq == ERR_PTR(-EAGAIN));
+
+	priv->rht_started = true;
+	if (dsq)
+		return dsq;
+
+	priv->rht_done = true;
+	return scx_dsq_seq_get_cgroup(priv, true);
+}
+
+static void *scx_dsq_seq_start(struct seq_file *seq, loff_t *pos)
+	__acquires(RCU)
+{
+	struct bpf_iter_scx_dsq_priv *priv = seq->private;
+	struct scx_dispatch_q *dsq;
+
+	rhashtable_walk_start(&priv->rht_iter);
+
+	/* resume from the DSQ which didn't fit in the last read() */
+	dsq = scx_dsq_seq_get(priv, false);
+	if (dsq && *pos == 0)
+		++*pos;
+	return dsq;
+}
+
+static void *scx_dsq_seq_next(struct seq_file *seq, void *v, loff_t *pos)
+{
+	struct bpf_iter_scx_dsq_priv *priv = seq->private;
+
+	++*pos;
+	return scx_dsq_seq_get(priv, true);
+}
+
+static int __scx_dsq_seq_show(struct seq_file *seq, void *v, bool in_stop)
+{
+	struct bpf_iter__sched_ext_dsq ctx;
+	struct scx_dsq_peek_info head;
+	struct scx_dispatch_q *dsq = v;
+	struct bpf_iter_meta meta;
+	struct bpf_prog *prog;
+	bool has_head = false;
+	unsigned long flags;
+
+	meta.seq = seq;
+	prog = bpf_iter_get_info(&meta, in_stop);
+	if (!prog)
+		return 0;
+
+	/* local DSQs are protected by their rq locks */
+	if (dsq && dsq->id == SCX_DSQ_LOCAL) {
+		struct rq *rq = container_of(dsq, struct rq, scx.local_dsq);
+		struct rq_flags rf;
+
+		rq_lock_irqsave(rq, &rf);
+		has_head = peek_dsq_head(dsq, &head);
+		rq_unlock_irqrestore(rq, &rf);
+	} else if (dsq) {
+		raw_spin_lock_irqsave(&dsq->lock, flags);
+		has_head = peek_dsq_head(dsq, &head);
+		raw_spin_unlock_irqrestore(&dsq->lock, flags);
+	}
+
+	ctx.meta = &meta;
+	ctx.dsq = dsq;
+	ctx.head = has_head ? &head : NULL;
+	return bpf_iter_run_prog(prog, &ctx);
+}
+
+static int scx_dsq_seq_show(struct seq_file *seq, void *v)
+{
+	return __scx_dsq_seq_show(seq, v, false);
+}
+
+static void scx_dsq_seq_stop(struct seq_file *seq, void *v)
+	__releases(RCU)
+{
+	struct bpf_iter_scx_dsq_priv *priv = seq->private;
+
+	if (!v)
+		(void)__scx_dsq_seq_show(seq, v, true);
+
+	rhashtable_walk_stop(&priv->rht_iter);
+}
+
+static int scx_dsq_seq_init(void *priv_data, struct bpf_iter_aux_info *aux)
+{
+	struct bpf_iter_scx_dsq_priv *priv = priv_data;
+
+	rhashtable_walk_enter(&dsq_hash, &priv->rht_iter);
+	priv->cpu = -1;
+	priv->rht_started = false;
+	priv->rht_done = false;
+#ifdef CONFIG_EXT_GROUP_SCHED
+	priv->css = NULL;
+	priv->cgrp_done = false;
+#endif
+	return 0;
+}
+
+static void scx_dsq_seq_fini(void *priv_data)
+{
+	struct bpf_iter_scx_dsq_priv *priv = priv_data;
+
+	rhashtable_walk_exit(&priv->rht_iter);
+#ifdef CONFIG_EXT_GROUP_SCHED
+	if (priv->css)
+		css_put(priv->css);
+#endif
+}
+
+static const struct seq_operations scx_dsq_seq_ops = {
+	.start	= scx_dsq_seq_start,
+	.next	= scx_dsq_seq_next,
+	.stop	= scx_dsq_seq_stop,
+	.show	= scx_dsq_seq_show,
+};
+
+static const struct bpf_iter_seq_info scx_dsq_seq_info = {
+	.seq_ops		= &scx_dsq_seq_ops,
+	.init_seq_private	= scx_dsq_seq_init,
+	.fini_seq_private	= scx_dsq_seq_fini,
+	.seq_priv_size		= sizeof(struct bpf_iter_scx_dsq_priv),
+};
+
+static struct bpf_iter_reg scx_dsq_reg_info = {
+	.target			= "sched_ext_dsq",
+	.ctx_arg_info_size	= 2,
+	.ctx_arg_info		= {
+		{ offsetof(struct bpf_iter__sched_ext_dsq, dsq),
+		  PTR_TO_BTF_ID_OR_NULL },
+		{ offsetof(struct bpf_iter__sched_ext_dsq, head),
+		  PTR_TO_BTF_ID_OR_NULL },
+	},
+	.seq_info		= &scx_dsq_seq_info,
+};
+
+BTF_ID_LIST(scx_iter_btf_ids)
+BTF_ID(struct, task_struct)
+BTF_ID(struct, scx_dispatch_q)
+BTF_ID(struct, scx_dsq_peek_info)
+
+static int __init register_ext_iters(void)
+{
+	int ret;
+
+	scx_task_reg_info.ctx_arg_info[0].btf_id = scx_iter_btf_ids[0];
+	scx_dsq_reg_info.ctx_arg_info[0].btf_id = scx_iter_btf_ids[1];
+	scx_dsq_reg_info.ctx_arg_info[1].btf_id = scx_iter_btf_ids[2];
+
+	ret = bpf_iter_reg_target(&scx_task_reg_info);
+	if (ret)
+		return ret;
+
+	return bpf_iter_reg_target(&scx_dsq_reg_info);
+}
+late_initcall(register_ext_iters);
@@ -29,6 +29,18 @@ enum scx_enq_flags {
 	 */
 	SCX_ENQ_PREEMPT		= 1LLU << 32,
 
+	/*
+	 * Like %SCX_ENQ_PREEMPT but only preempts the current task if the task
+	 * being dispatched has an earlier p->scx.dsq_vtime than the current
+	 * task and is going to run next. As the local FIFO is picked before the
+	 * local priority queue, the latter requires the FIFO to be empty and
+	 * the task to be at the head of the priority queue. Doesn't imply
+	 * %SCX_ENQ_HEAD. Usually combined with scx_bpf_dispatch_vtime()
+	 * targeting a local DSQ so that the local DSQ stays vtime ordered and
+	 * wakeup preemption follows the same ordering.
+	 */
+	SCX_ENQ_PREEMPT_IF_EARLIER = 1LLU << 33,
+
 	/*
 	 * The task being enqueued was previously enqueued on the current CPU's
 	 * %SCX_DSQ_LOCAL, but was removed from it in a call to the
@@ -111,6 +123,8 @@ void sched_enq_and_set_task(struct sched_enq_and_set_ctx *ctx);
 extern const struct sched_class ext_sched_class;
 extern const struct bpf_verifier_ops bpf_sched_ext_verifier_ops;
 extern const struct file_operations sched_ext_fops;
+extern const struct file_operations sched_ext_op_stats_fops;
+extern const struct file_operations sched_ext_idle_pending_stats_fops;
 extern unsigned long scx_watchdog_timeout;
 extern unsigned long scx_watchdog_timestamp;
 
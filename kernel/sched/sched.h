@@ -427,6 +427,8 @@ struct task_group {
 #ifdef CONFIG_EXT_GROUP_SCHED
 	u32			scx_flags;	/* SCX_TG_* */
 	u32			scx_weight;
+	/* see %SCX_OPS_CGROUP_DSQ, protected by scx_cgroup_rwsem and RCU */
+	struct scx_dispatch_q __rcu *scx_dsq;
 #endif
 
 	struct rcu_head		rcu;
@@ -714,6 +716,7 @@ struct scx_rq {
 	cpumask_var_t		cpus_to_wait;
 	u64			pnt_seq;
 	struct irq_work		kick_cpus_irq_work;
+	void			*cpu_ctx;	/* see sched_ext_ops.cpu_ctx_size */
 };
 #endif /* CONFIG_SCHED_CLASS_EXT */
 
@@ -217,8 +217,33 @@ static void refresh_tune_params(void)
 	}
 }
 
-static bool task_set_domain(struct task_ctx *task_ctx, struct task_struct *p,
-			    u32 new_dom_id, bool init_dsq_vtime)
+/*
+ * Return the CPUs @p can run on in its current domain. A task whose affinity
+ * covers its whole domain shares the domain's cpumask and only tasks with
+ * narrower affinities own a private one, see task_set_domain().
+ */
+static struct bpf_cpumask *task_cpumask(struct task_ctx *task_ctx)
+{
+	struct bpf_cpumask *cpumask = task_ctx->cpumask;
+	struct dom_ctx *domc;
+	u32 dom_id = task_ctx->dom_id;
+
+	if (cpumask)
+		return cpumask;
+
+	domc = bpf_map_lookup_elem(&dom_ctx, &dom_id);
+	if (!domc)
+		return NULL;
+	return domc->cpumask;
+}
+
+/*
+ * Move @p to @new_dom_id. Returns 0 on success, -ENOMEM if @p's affinity
+ * needs a private cpumask which couldn't be allocated and -EINVAL if @p can't
+ * run in @new_dom_id. On failure, @p stays in its current domain.
+ */
+static s32 task_set_domain(struct task_ctx *task_ctx, struct task_struct *p,
+			   u32 new_dom_id, bool init_dsq_vtime)
 {
 	struct dom_ctx *old_domc, *new_domc;
 	struct bpf_cpumask *d_cpumask, *t_cpumask;
@@ -228,7 +253,7 @@ static bool task_set_domain(struct task_ctx *task_ctx, struct task_struct *p,
 	old_domc = bpf_map_lookup_elem(&dom_ctx, &old_dom_id);
 	if (!old_domc) {
 		scx_bpf_error("Failed to lookup old dom%u", old_dom_id);
-		return false;
+		return -ENOENT;
 	}
 
 	if (init_dsq_vtime)
@@ -239,35 +264,57 @@ static bool task_set_domain(struct task_ctx *task_ctx, struct task_struct *p,
 	new_domc = bpf_map_lookup_elem(&dom_ctx, &new_dom_id);
 	if (!new_domc) {
 		scx_bpf_error("Failed to lookup new dom%u", new_dom_id);
-		return false;
+		return -ENOENT;
 	}
 
 	d_cpumask = new_domc->cpumask;
 	if (!d_cpumask) {
 		scx_bpf_error("Failed to get dom%u cpumask kptr",
 			      new_dom_id);
-		return false;
-	}
-
-	t_cpumask = task_ctx->cpumask;
-	if (!t_cpumask) {
-		scx_bpf_error("Failed to look up task cpumask");
-		return false;
+		return -ENOENT;
 	}
 
 	/*
 	 * set_cpumask might have happened between userspace requesting LB and
 	 * here and @p might not be able to run in @dom_id anymore. Verify.
 	 */
-	if (bpf_cpumask_intersects((const struct cpumask *)d_cpumask,
-				   p->cpus_ptr)) {
-		p->scx.dsq_vtime = new_domc->vtime_now + vtime_delta;
-		task_ctx->dom_id = new_dom_id;
+	if (!bpf_cpumask_intersects((const struct cpumask *)d_cpumask,
+				    p->cpus_ptr))
+		return task_ctx->dom_id == new_dom_id ? 0 : -EINVAL;
+
+	/*
+	 * Most tasks can run on every CPU of their domain. Let them share the
+	 * domain's cpumask so that fork and exit don't allocate and free a
+	 * mask per task.
+	 */
+	if (bpf_cpumask_subset((const struct cpumask *)d_cpumask, p->cpus_ptr)) {
+		t_cpumask = bpf_kptr_xchg(&task_ctx->cpumask, NULL);
+		if (t_cpumask)
+			bpf_cpumask_release(t_cpumask);
+	} else {
+		t_cpumask = task_ctx->cpumask;
+		if (!t_cpumask) {
+			/* the callers decide whether this is fatal */
+			t_cpumask = bpf_cpumask_create();
+			if (!t_cpumask)
+				return -ENOMEM;
+			t_cpumask = bpf_kptr_xchg(&task_ctx->cpumask, t_cpumask);
+			if (t_cpumask)
+				bpf_cpumask_release(t_cpumask);
+
+			t_cpumask = task_ctx->cpumask;
+			if (!t_cpumask) {
+				scx_bpf_error("Failed to look up task cpumask");
+				return -ENOENT;
+			}
+		}
 		bpf_cpumask_and(t_cpumask, (const struct cpumask *)d_cpumask,
 				p->cpus_ptr);
 	}
 
-	return task_ctx->dom_id == new_dom_id;
+	p->scx.dsq_vtime = new_domc->vtime_now + vtime_delta;
+	task_ctx->dom_id = new_dom_id;
+	return 0;
 }
 
 s32 BPF_STRUCT_OPS(atropos_select_cpu, struct task_struct *p, s32 prev_cpu,
@@ -283,7 +330,7 @@ s32 BPF_STRUCT_OPS(atropos_select_cpu, struct task_struct *p, s32 prev_cpu,
 	refresh_tune_params();
 
 	if (!(task_ctx = bpf_map_lookup_elem(&task_data, &pid)) ||
-	    !(p_cpumask = task_ctx->cpumask))
+	    !(p_cpumask = task_cpumask(task_ctx)))
 		goto enoent;
 
 	if (kthreads_local &&
@@ -505,7 +552,7 @@ void BPF_STRUCT_OPS(atropos_enqueue, struct task_struct *p, u64 enq_flags)
 	s32 cpu;
 
 	if (!(task_ctx = bpf_map_lookup_elem(&task_data, &pid)) ||
-	    !(p_cpumask = task_ctx->cpumask)) {
+	    !(p_cpumask = task_cpumask(task_ctx))) {
 		scx_bpf_error("Failed to lookup task_ctx or cpumask");
 		return;
 	}
@@ -514,10 +561,15 @@ void BPF_STRUCT_OPS(atropos_enqueue, struct task_struct *p, u64 enq_flags)
 	 * Migrate @p to a new domain if requested by userland through lb_data.
 	 */
 	new_dom = bpf_map_lookup_elem(&lb_data, &pid);
+	/* on failure, @p stays in its current domain which is still valid */
 	if (new_dom && *new_dom != task_ctx->dom_id &&
-	    task_set_domain(task_ctx, p, *new_dom, false)) {
+	    !task_set_domain(task_ctx, p, *new_dom, false)) {
 		stat_add(ATROPOS_STAT_LOAD_BALANCE, 1);
 		task_ctx->dispatch_local = false;
+		if (!(p_cpumask = task_cpumask(task_ctx))) {
+			scx_bpf_error("Failed to lookup task cpumask");
+			return;
+		}
 		cpu = scx_bpf_pick_any_cpu((const struct cpumask *)p_cpumask, 0);
 		if (cpu >= 0)
 			scx_bpf_kick_cpu(cpu, 0);
@@ -595,19 +647,38 @@ void BPF_STRUCT_OPS(atropos_enqueue, struct task_struct *p, u64 enq_flags)
 	}
 }
 
-static bool cpumask_intersects_domain(const struct cpumask *cpumask, u32 dom_id)
+/*
+ * Returns 1 if @cpumask intersects @dom_id, 0 if not, -errno if the cpumask
+ * iterator couldn't be initialized.
+ */
+static s32 cpumask_intersects_domain(const struct cpumask *cpumask, u32 dom_id)
 {
-	s32 cpu;
+	struct bpf_iter_cpumask it;
+	s32 ret = 0;
+	int *cpu;
 
 	if (dom_id >= MAX_DOMS)
-		return false;
+		return 0;
 
-	bpf_for(cpu, 0, nr_cpus) {
-		if (bpf_cpumask_test_cpu(cpu, cpumask) &&
-		    (dom_cpumasks[dom_id][cpu / 64] & (1LLU << (cpu % 64))))
-			return true;
+	if (bpf_iter_cpumask_new(&it, cpumask)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	while ((cpu = bpf_iter_cpumask_next(&it))) {
+		const volatile __u64 *dmask;
+
+		dmask = MEMBER_VPTR(dom_cpumasks, [dom_id][*cpu / 64]);
+		if (!dmask)
+			break;
+		if (*dmask & (1LLU << (*cpu % 64))) {
+			ret = 1;
+			break;
+		}
 	}
-	return false;
+out:
+	bpf_iter_cpumask_destroy(&it);
+	return ret;
 }
 
 static u32 dom_rr_next(s32 cpu)
@@ -734,11 +805,16 @@ void BPF_STRUCT_OPS(atropos_set_weight, struct task_struct *p, u32 weight)
 	task_ctx->weight = weight;
 }
 
-static u32 task_pick_domain(struct task_ctx *task_ctx, struct task_struct *p,
+/*
+ * Returns the first domain intersecting @cpumask, %MAX_DOMS if there's none,
+ * or -errno on failure.
+ */
+static s32 task_pick_domain(struct task_ctx *task_ctx, struct task_struct *p,
 			    const struct cpumask *cpumask)
 {
 	s32 cpu = bpf_get_smp_processor_id();
 	u32 first_dom = MAX_DOMS, dom;
+	s32 ret;
 
 	if (cpu < 0 || cpu >= MAX_CPUS)
 		return MAX_DOMS;
@@ -748,7 +824,10 @@ static u32 task_pick_domain(struct task_ctx *task_ctx, struct task_struct *p,
 	dom = pcpu_ctx[cpu].dom_rr_cur++;
 	bpf_repeat(nr_doms) {
 		dom = (dom + 1) % nr_doms;
-		if (cpumask_intersects_domain(cpumask, dom)) {
+		ret = cpumask_intersects_domain(cpumask, dom);
+		if (ret < 0)
+			return ret;
+		if (ret) {
 			task_ctx->dom_mask |= 1LLU << dom;
 			/*
 			 * AsThe starting point is round-robin'd and the first
@@ -762,19 +841,20 @@ static u32 task_pick_domain(struct task_ctx *task_ctx, struct task_struct *p,
 	return first_dom;
 }
 
-static void task_pick_and_set_domain(struct task_ctx *task_ctx,
-				     struct task_struct *p,
-				     const struct cpumask *cpumask,
-				     bool init_dsq_vtime)
+static s32 task_pick_and_set_domain(struct task_ctx *task_ctx,
+				    struct task_struct *p,
+				    const struct cpumask *cpumask,
+				    bool init_dsq_vtime)
 {
-	u32 dom_id = 0;
+	s32 dom_id = 0;
 
-	if (nr_doms > 1)
+	if (nr_doms > 1) {
 		dom_id = task_pick_domain(task_ctx, p, cpumask);
+		if (dom_id < 0)
+			return dom_id;
+	}
 
-	if (!task_set_domain(task_ctx, p, dom_id, init_dsq_vtime))
-		scx_bpf_error("Failed to set dom%d for %s[%d]",
-			      dom_id, p->comm, p->pid);
+	return task_set_domain(task_ctx, p, dom_id, init_dsq_vtime);
 }
 
 void BPF_STRUCT_OPS(atropos_set_cpumask, struct task_struct *p,
@@ -782,6 +862,7 @@ void BPF_STRUCT_OPS(atropos_set_cpumask, struct task_struct *p,
 {
 	struct task_ctx *task_ctx;
 	pid_t pid = p->pid;
+	s32 ret;
 
 	if (!(task_ctx = bpf_map_lookup_elem(&task_data, &pid))) {
 		scx_bpf_error("Failed to lookup task_ctx for %s[%d]",
@@ -789,14 +870,23 @@ void BPF_STRUCT_OPS(atropos_set_cpumask, struct task_struct *p,
 		return;
 	}
 
-	task_pick_and_set_domain(task_ctx, p, cpumask, false);
+	/*
+	 * If @p's affinity got narrower than its domain and the private cpumask
+	 * couldn't be allocated, @p would keep running on CPUs it isn't allowed
+	 * on. This can't be failed gracefully, abort.
+	 */
+	ret = task_pick_and_set_domain(task_ctx, p, cpumask, false);
+	if (ret) {
+		scx_bpf_error("Failed to set domain for %s[%d] (%d)",
+			      p->comm, pid, ret);
+		return;
+	}
 	task_ctx->all_cpus = bpf_cpumask_full(cpumask);
 }
 
 s32 BPF_STRUCT_OPS(atropos_prep_enable, struct task_struct *p,
 		   struct scx_enable_args *args)
 {
-	struct bpf_cpumask *cpumask;
 	struct task_ctx task_ctx, *map_value;
 	long ret;
 	pid_t pid;
@@ -811,30 +901,20 @@ s32 BPF_STRUCT_OPS(atropos_prep_enable, struct task_struct *p,
 	}
 
 	/*
-	 * Read the entry from the map immediately so we can add the cpumask
-	 * with bpf_kptr_xchg().
+	 * Read the entry from the map immediately so that the domain and, for
+	 * tasks with restricted affinities, the private cpumask can be set.
 	 */
 	map_value = bpf_map_lookup_elem(&task_data, &pid);
 	if (!map_value)
 		/* Should never happen -- it was just inserted above. */
 		return -EINVAL;
 
-	cpumask = bpf_cpumask_create();
-	if (!cpumask) {
-		bpf_map_delete_elem(&task_data, &pid);
-		return -ENOMEM;
-	}
-
-	cpumask = bpf_kptr_xchg(&map_value->cpumask, cpumask);
-	if (cpumask) {
-		/* Should never happen as we just inserted it above. */
-		bpf_cpumask_release(cpumask);
+	ret = task_pick_and_set_domain(map_value, p, p->cpus_ptr, true);
+	if (ret) {
 		bpf_map_delete_elem(&task_data, &pid);
-		return -EINVAL;
+		return ret;
 	}
 
-	task_pick_and_set_domain(map_value, p, p->cpus_ptr, true);
-
 	return 0;
 }
 
@@ -974,5 +1054,11 @@ struct sched_ext_ops atropos = {
 	.disable		= (void *)atropos_disable,
 	.init			= (void *)atropos_init,
 	.exit			= (void *)atropos_exit,
+	/*
+	 * Greedy stealing pulls tasks across domains. Let the core skip over
+	 * tasks which are still cache-hot in their previous LLC if a cold one
+	 * is available in the same DSQ.
+	 */
+	.flags			= SCX_OPS_CONSUME_COLD_FIRST,
 	.name			= "atropos",
 };
@@ -45,6 +45,7 @@ struct task_ctx {
 	/* The domains this task can run on */
 	unsigned long long dom_mask;
 
+	/* NULL if the task can run on all CPUs of its domain */
 	struct bpf_cpumask __kptr *cpumask;
 	unsigned int dom_id;
 	unsigned int weight;
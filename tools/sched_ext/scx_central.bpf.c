@@ -46,6 +46,8 @@
  * Copyright (c) 2022 David Vernet <dvernet@meta.com>
  */
 #include "scx_common.bpf.h"
+#include "scx_stats.h"
+#include "scx_central.h"
 
 char _license[] SEC("license") = "GPL";
 
@@ -60,14 +62,13 @@ const volatile bool switch_partial;
 const volatile s32 central_cpu;
 const volatile u32 nr_cpu_ids = 64;	/* !0 for veristat, set during init */
 
-u64 nr_total, nr_locals, nr_queued, nr_lost_pids;
-u64 nr_timers, nr_dispatches, nr_mismatches, nr_retries;
-u64 nr_overflows;
+u64 nr_queued, nr_timers;
 
 struct user_exit_info uei;
 
 struct {
 	__uint(type, BPF_MAP_TYPE_QUEUE);
+	__uint(map_flags, BPF_F_QUEUE_MPMC);
 	__uint(max_entries, 4096);
 	__type(value, s32);
 } central_q SEC(".maps");
@@ -108,7 +109,7 @@ void BPF_STRUCT_OPS(central_enqueue, struct task_struct *p, u64 enq_flags)
 {
 	s32 pid = p->pid;
 
-	__sync_fetch_and_add(&nr_total, 1);
+	scx_stat_inc(CENTRAL_STAT_TOTAL);
 
 	/*
 	 * Push per-cpu kthreads at the head of local dsq's and preempt the
@@ -117,14 +118,14 @@ void BPF_STRUCT_OPS(central_enqueue, struct task_struct *p, u64 enq_flags)
 	 * guarantee as we depend on the BPF timer which may run from ksoftirqd.
 	 */
 	if ((p->flags & PF_KTHREAD) && p->nr_cpus_allowed == 1) {
-		__sync_fetch_and_add(&nr_locals, 1);
+		scx_stat_inc(CENTRAL_STAT_LOCAL);
 		scx_bpf_dispatch(p, SCX_DSQ_LOCAL, SCX_SLICE_INF,
 				 enq_flags | SCX_ENQ_PREEMPT);
 		return;
 	}
 
 	if (bpf_map_push_elem(&central_q, &pid, 0)) {
-		__sync_fetch_and_add(&nr_overflows, 1);
+		scx_stat_inc(CENTRAL_STAT_OVERFLOW);
 		scx_bpf_dispatch(p, FALLBACK_DSQ_ID, SCX_SLICE_INF, enq_flags);
 		return;
 	}
@@ -148,7 +149,7 @@ static bool dispatch_to_cpu(s32 cpu)
 
 		p = bpf_task_from_pid(pid);
 		if (!p) {
-			__sync_fetch_and_add(&nr_lost_pids, 1);
+			scx_stat_inc(CENTRAL_STAT_LOST_PID);
 			continue;
 		}
 
@@ -157,7 +158,7 @@ static bool dispatch_to_cpu(s32 cpu)
 		 * bounce it to the fallback dsq.
 		 */
 		if (!bpf_cpumask_test_cpu(cpu, p->cpus_ptr)) {
-			__sync_fetch_and_add(&nr_mismatches, 1);
+			scx_stat_inc(CENTRAL_STAT_MISMATCH);
 			scx_bpf_dispatch(p, FALLBACK_DSQ_ID, SCX_SLICE_INF, 0);
 			bpf_task_release(p);
 			continue;
@@ -180,7 +181,7 @@ void BPF_STRUCT_OPS(central_dispatch, s32 cpu, struct task_struct *prev)
 {
 	if (cpu == central_cpu) {
 		/* dispatch for all other CPUs first */
-		__sync_fetch_and_add(&nr_dispatches, 1);
+		scx_stat_inc(CENTRAL_STAT_DISPATCH);
 
 		bpf_for(cpu, 0, nr_cpu_ids) {
 			bool *gimme;
@@ -205,7 +206,7 @@ void BPF_STRUCT_OPS(central_dispatch, s32 cpu, struct task_struct *prev)
 		 * Kick self explicitly to retry.
 		 */
 		if (!scx_bpf_dispatch_nr_slots()) {
-			__sync_fetch_and_add(&nr_retries, 1);
+			scx_stat_inc(CENTRAL_STAT_RETRY);
 			scx_bpf_kick_cpu(central_cpu, SCX_KICK_PREEMPT);
 			return;
 		}
@@ -12,6 +12,8 @@
 #include <libgen.h>
 #include <bpf/bpf.h>
 #include "user_exit_info.h"
+#include "scx_stats.h"
+#include "scx_central.h"
 #include "scx_central.skel.h"
 
 const char help_fmt[] =
@@ -19,12 +21,23 @@ const char help_fmt[] =
 "\n"
 "See the top-level comment in .bpf.c for more details.\n"
 "\n"
-"Usage: %s [-c CPU] [-p]\n"
+"Usage: %s [-c CPU] [-p] [-S]\n"
 "\n"
 "  -c CPU        Override the central CPU (default: 0)\n"
 "  -p            Switch only tasks on SCHED_EXT policy intead of all\n"
+"  -S            Print statistics in the machine-readable scx_stats format\n"
 "  -h            Display this help and exit\n";
 
+static const char * const central_stat_names[CENTRAL_NR_STATS] = {
+	[CENTRAL_STAT_TOTAL]	= "total",
+	[CENTRAL_STAT_LOCAL]	= "local",
+	[CENTRAL_STAT_LOST_PID]	= "lost_pid",
+	[CENTRAL_STAT_DISPATCH]	= "dispatch",
+	[CENTRAL_STAT_MISMATCH]	= "mismatch",
+	[CENTRAL_STAT_RETRY]	= "retry",
+	[CENTRAL_STAT_OVERFLOW]	= "overflow",
+};
+
 static volatile int exit_req;
 
 static void sigint_handler(int dummy)
@@ -36,6 +49,8 @@ int main(int argc, char **argv)
 {
 	struct scx_central *skel;
 	struct bpf_link *link;
+	struct scx_stats st;
+	bool print_scx_stats = false;
 	u64 seq = 0;
 	s32 opt;
 
@@ -50,7 +65,10 @@ int main(int argc, char **argv)
 	skel->rodata->central_cpu = 0;
 	skel->rodata->nr_cpu_ids = libbpf_num_possible_cpus();
 
-	while ((opt = getopt(argc, argv, "c:ph")) != -1) {
+	assert(!scx_stats_init(&st, skel->maps.scx_stats, central_stat_names,
+			       CENTRAL_NR_STATS));
+
+	while ((opt = getopt(argc, argv, "c:pSh")) != -1) {
 		switch (opt) {
 		case 'c':
 			skel->rodata->central_cpu = strtoul(optarg, NULL, 0);
@@ -58,6 +76,9 @@ int main(int argc, char **argv)
 		case 'p':
 			skel->rodata->switch_partial = true;
 			break;
+		case 'S':
+			print_scx_stats = true;
+			break;
 		default:
 			fprintf(stderr, help_fmt, basename(argv[0]));
 			return opt != 'h';
@@ -65,30 +86,42 @@ int main(int argc, char **argv)
 	}
 
 	assert(!scx_central__load(skel));
+	assert(!scx_stats_mmap(&st));
 
 	link = bpf_map__attach_struct_ops(skel->maps.central_ops);
 	assert(link);
 
 	while (!exit_req && !uei_exited(&skel->bss->uei)) {
+		__u64 stats[CENTRAL_NR_STATS];
+
+		scx_stats_read(&st, stats);
+
+		if (print_scx_stats) {
+			scx_stats_print(&st, stats, "central", stdout);
+			sleep(1);
+			continue;
+		}
+
 		printf("[SEQ %lu]\n", seq++);
-		printf("total   :%10lu    local:%10lu   queued:%10lu  lost:%10lu\n",
-		       skel->bss->nr_total,
-		       skel->bss->nr_locals,
+		printf("total   :%10llu    local:%10llu   queued:%10lu  lost:%10llu\n",
+		       stats[CENTRAL_STAT_TOTAL],
+		       stats[CENTRAL_STAT_LOCAL],
 		       skel->bss->nr_queued,
-		       skel->bss->nr_lost_pids);
-		printf("timer   :%10lu dispatch:%10lu mismatch:%10lu retry:%10lu\n",
+		       stats[CENTRAL_STAT_LOST_PID]);
+		printf("timer   :%10lu dispatch:%10llu mismatch:%10llu retry:%10llu\n",
 		       skel->bss->nr_timers,
-		       skel->bss->nr_dispatches,
-		       skel->bss->nr_mismatches,
-		       skel->bss->nr_retries);
-		printf("overflow:%10lu\n",
-		       skel->bss->nr_overflows);
+		       stats[CENTRAL_STAT_DISPATCH],
+		       stats[CENTRAL_STAT_MISMATCH],
+		       stats[CENTRAL_STAT_RETRY]);
+		printf("overflow:%10llu\n",
+		       stats[CENTRAL_STAT_OVERFLOW]);
 		fflush(stdout);
 		sleep(1);
 	}
 
 	bpf_link__destroy(link);
 	uei_print(&skel->bss->uei);
+	scx_stats_munmap(&st);
 	scx_central__destroy(skel);
 	return 0;
 }
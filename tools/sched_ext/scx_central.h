@@ -0,0 +1,23 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Statistics counter indices shared between scx_central.bpf.c and
+ * scx_central.c. See scx_stats.h.
+ *
+ * Copyright (c) 2023 Meta Platforms, Inc. and affiliates.
+ */
+#ifndef __SCX_EXAMPLE_CENTRAL_H
+#define __SCX_EXAMPLE_CENTRAL_H
+
+enum central_stat_idx {
+	CENTRAL_STAT_TOTAL,
+	CENTRAL_STAT_LOCAL,
+	CENTRAL_STAT_LOST_PID,
+	CENTRAL_STAT_DISPATCH,
+	CENTRAL_STAT_MISMATCH,
+	CENTRAL_STAT_RETRY,
+	CENTRAL_STAT_OVERFLOW,
+
+	CENTRAL_NR_STATS,
+};
+
+#endif /* __SCX_EXAMPLE_CENTRAL_H */
@@ -55,12 +55,19 @@ void ___scx_bpf_error_format_checker(const char *fmt, ...) {}
 
 void scx_bpf_switch_all(void) __ksym;
 s32 scx_bpf_create_dsq(u64 dsq_id, s32 node) __ksym;
+s32 scx_bpf_create_dsq_flags(u64 dsq_id, s32 node, u32 max_nr, u64 flags) __ksym;
 bool scx_bpf_consume(u64 dsq_id) __ksym;
+bool scx_bpf_consume_if_head(u64 dsq_id, u64 seq) __ksym;
+bool scx_bpf_consume_cgroup(struct cgroup *cgrp) __ksym;
 u32 scx_bpf_dispatch_nr_slots(void) __ksym;
 void scx_bpf_dispatch(struct task_struct *p, u64 dsq_id, u64 slice, u64 enq_flags) __ksym;
 void scx_bpf_dispatch_vtime(struct task_struct *p, u64 dsq_id, u64 slice, u64 vtime, u64 enq_flags) __ksym;
+void scx_bpf_dispatch_edf(struct task_struct *p, u64 dsq_id, u64 deadline, u64 vtime, u64 enq_flags) __ksym;
+s32 scx_bpf_dispatch_capped(struct task_struct *p, u64 dsq_id, u64 slice, u64 enq_flags) __ksym;
 void scx_bpf_kick_cpu(s32 cpu, u64 flags) __ksym;
 s32 scx_bpf_dsq_nr_queued(u64 dsq_id) __ksym;
+s32 scx_bpf_cgroup_dsq_nr_queued(struct cgroup *cgrp) __ksym;
+s32 scx_bpf_dsq_peek(u64 dsq_id, struct scx_dsq_peek_info *info) __ksym;
 bool scx_bpf_test_and_clear_cpu_idle(s32 cpu) __ksym;
 s32 scx_bpf_pick_idle_cpu(const cpumask_t *cpus_allowed, u64 flags) __ksym;
 s32 scx_bpf_pick_any_cpu(const cpumask_t *cpus_allowed, u64 flags) __ksym;
@@ -70,6 +77,13 @@ void scx_bpf_put_idle_cpumask(const struct cpumask *cpumask) __ksym;
 void scx_bpf_destroy_dsq(u64 dsq_id) __ksym;
 bool scx_bpf_task_running(const struct task_struct *p) __ksym;
 s32 scx_bpf_task_cpu(const struct task_struct *p) __ksym;
+u64 scx_bpf_task_since_ran(const struct task_struct *p) __ksym;
+bool scx_bpf_task_cache_hot(const struct task_struct *p, s32 cpu) __ksym;
+s32 scx_bpf_cpu_llc_id(s32 cpu) __ksym;
+void *scx_bpf_cpu_ctx(s32 cpu, const int rdwr_buf_size) __ksym;
+u32 scx_bpf_nr_affn_classes(void) __ksym;
+const struct cpumask *scx_bpf_get_affn_class_cpumask(u32 class_id) __ksym;
+void scx_bpf_put_cpumask(const struct cpumask *cpumask) __ksym;
 struct cgroup *scx_bpf_task_cgroup(struct task_struct *p) __ksym;
 u32 scx_bpf_reenqueue_local(void) __ksym;
 
@@ -117,6 +131,32 @@ BPF_PROG(name, ##args)
 	__addr;									\
 })
 
+/**
+ * scx_task_data - Access the inline per-task scratch area
+ * @p: task_struct pointer
+ * @type: type of the per-task context
+ *
+ * Returns @p->scx.sched_data cast to a pointer to @type, which must fit in
+ * SCX_TASK_DATA_U64S u64's. The area is zeroed before ops.prep_enable() and
+ * can be read and written directly, saving a bpf_task_storage_get() per
+ * callback for small contexts which don't contain kptrs.
+ */
+#define scx_task_data(p, type) ({						\
+	_Static_assert(sizeof(type) <= sizeof((p)->scx.sched_data),		\
+		       #type " too large for sched_data");			\
+	(type *)(p)->scx.sched_data;						\
+})
+
+/**
+ * scx_cpu_ctx - Access the per-CPU context area
+ * @cpu: CPU of interest
+ * @type: type of the per-CPU context
+ *
+ * Returns @cpu's context area allocated by the core as a pointer to @type, or
+ * NULL on error. sched_ext_ops.cpu_ctx_size should be set to sizeof(@type).
+ */
+#define scx_cpu_ctx(cpu, type)	((type *)scx_bpf_cpu_ctx((cpu), sizeof(type)))
+
 /*
  * BPF core and other generic helpers
  */
@@ -193,6 +233,13 @@ extern int bpf_iter_num_new(struct bpf_iter_num *it, int start, int end) __ksym;
 extern int *bpf_iter_num_next(struct bpf_iter_num *it) __ksym;
 extern void bpf_iter_num_destroy(struct bpf_iter_num *it) __ksym;
 
+struct bpf_iter_cpumask;
+
+extern int bpf_iter_cpumask_new(struct bpf_iter_cpumask *it,
+				const struct cpumask *mask) __ksym;
+extern int *bpf_iter_cpumask_next(struct bpf_iter_cpumask *it) __ksym;
+extern void bpf_iter_cpumask_destroy(struct bpf_iter_cpumask *it) __ksym;
+
 #ifndef bpf_for_each
 /* bpf_for_each(iter_type, cur_elem, args...) provides generic construct for
  * using BPF open-coded iterators without having to write mundane explicit
@@ -269,6 +316,30 @@ extern void bpf_iter_num_destroy(struct bpf_iter_num *it) __ksym;
 )
 #endif /* bpf_for */
 
+/* bpf_for_each_cpu(cpu, mask) sets integer variable *cpu* to each CPU set in
+ * *mask*, a `const struct cpumask *`, in ascending order. The cost is
+ * proportional to the number of set CPUs rather than the number of possible
+ * CPUs. On systems with more than 256 possible CPUs, the iterator allocates a
+ * copy of *mask* and nothing is visited if that fails. Use the
+ * bpf_iter_cpumask_*() kfuncs directly if the failure needs to be handled.
+ */
+#define bpf_for_each_cpu(cpu, mask) for (							\
+	/* initialize and define destructor */							\
+	struct bpf_iter_cpumask ___it __attribute__((aligned(8), /* enforce, just in case */	\
+						     cleanup(bpf_iter_cpumask_destroy))),	\
+	/* ___p pointer is necessary to call bpf_iter_cpumask_new() *once* to init ___it */	\
+				*___p __attribute__((unused)) = (				\
+				bpf_iter_cpumask_new(&___it, (mask)),				\
+	/* this is a workaround for Clang bug: it currently doesn't emit BTF */			\
+	/* for bpf_iter_cpumask_destroy() when used from cleanup() attribute */		\
+				(void)bpf_iter_cpumask_destroy, (void *)0);			\
+	({											\
+		/* iteration step and termination check */					\
+		int *___t = bpf_iter_cpumask_next(&___it);					\
+		(___t && ((cpu) = *___t, true));						\
+	});											\
+)
+
 #ifndef bpf_repeat
 /* bpf_repeat(N) performs N iterations without exposing iteration number
  *
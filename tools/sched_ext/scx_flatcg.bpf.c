@@ -42,9 +42,14 @@
  * The scheduler first picks the cgroup to run and then schedule the tasks
  * within by using nested weighted vtime scheduling by default. The
  * cgroup-internal scheduling can be switched to FIFO with the -f option.
+ *
+ * Each cgroup's tasks are queued on the DSQ which the core attaches to the
+ * cgroup with SCX_OPS_CGROUP_DSQ, so neither enqueueing nor consuming needs a
+ * DSQ ID lookup.
  */
 #include "scx_common.bpf.h"
 #include "user_exit_info.h"
+#include "scx_stats.h"
 #include "scx_flatcg.h"
 
 char _license[] SEC("license") = "GPL";
@@ -57,33 +62,33 @@ const volatile bool switch_partial;
 u64 cvtime_now;
 struct user_exit_info uei;
 
-struct {
-	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
-	__type(key, u32);
-	__type(value, u64);
-	__uint(max_entries, FCG_NR_STATS);
-} stats SEC(".maps");
-
 static void stat_inc(enum fcg_stat_idx idx)
 {
-	u32 idx_v = idx;
-
-	u64 *cnt_p = bpf_map_lookup_elem(&stats, &idx_v);
-	if (cnt_p)
-		(*cnt_p)++;
+	scx_stat_inc(idx);
 }
 
+/* allocated by the core, see flatcg_ops.cpu_ctx_size */
 struct fcg_cpu_ctx {
 	u64			cur_cgid;
 	u64			cur_at;
 };
 
+/*
+ * The cgroup of fcg_cpu_ctx->cur_cgid. Looking up a cgroup by ID takes the
+ * global kernfs_idr_lock, so cache it for fcg_dispatch() to keep consuming
+ * from it during the slice. This needs a kptr which the core-allocated
+ * fcg_cpu_ctx can't hold, hence the separate map.
+ */
+struct fcg_cpu_cgrp {
+	struct cgroup __kptr	*cgrp;
+};
+
 struct {
 	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
-	__type(key, u32);
-	__type(value, struct fcg_cpu_ctx);
 	__uint(max_entries, 1);
-} cpu_ctx SEC(".maps");
+	__type(key, u32);
+	__type(value, struct fcg_cpu_cgrp);
+} cpu_cgrp SEC(".maps");
 
 struct {
 	__uint(type, BPF_MAP_TYPE_CGRP_STORAGE);
@@ -112,18 +117,17 @@ struct {
 	__type(value, struct cgv_node_stash);
 } cgv_node_stash SEC(".maps");
 
+/* lives in p->scx.sched_data, see scx_task_data() */
 struct fcg_task_ctx {
 	u64		bypassed_at;
 };
 
-struct {
-	__uint(type, BPF_MAP_TYPE_TASK_STORAGE);
-	__uint(map_flags, BPF_F_NO_PREALLOC);
-	__type(key, int);
-	__type(value, struct fcg_task_ctx);
-} task_ctx SEC(".maps");
-
-/* gets inc'd on weight tree changes to expire the cached hweights */
+/*
+ * Gets inc'd on weight tree changes. If a cgroup's cached hweight_gen matches,
+ * none of its ancestors changed and the cached hweight can be used as-is.
+ * Otherwise, the per-parent fcg_cgrp_ctx->child_gen tells which levels
+ * actually need to be recomputed.
+ */
 unsigned long hweight_gen = 1;
 
 static u64 div_round_up(u64 dividend, u64 divisor)
@@ -146,12 +150,11 @@ static bool cgv_node_less(struct bpf_rb_node *a, const struct bpf_rb_node *b)
 	return cgc_a->cvtime < cgc_b->cvtime;
 }
 
-static struct fcg_cpu_ctx *find_cpu_ctx(void)
+static struct fcg_cpu_ctx *find_cpu_ctx(s32 cpu)
 {
 	struct fcg_cpu_ctx *cpuc;
-	u32 idx = 0;
 
-	cpuc = bpf_map_lookup_elem(&cpu_ctx, &idx);
+	cpuc = scx_cpu_ctx(cpu, struct fcg_cpu_ctx);
 	if (!cpuc) {
 		scx_bpf_error("cpu_ctx lookup failed");
 		return NULL;
@@ -190,6 +193,8 @@ static struct fcg_cgrp_ctx *find_ancestor_cgrp_ctx(struct cgroup *cgrp, int leve
 
 static void cgrp_refresh_hweight(struct cgroup *cgrp, struct fcg_cgrp_ctx *cgc)
 {
+	unsigned long gen = hweight_gen;
+	bool updated = false;
 	int level;
 
 	if (!cgc->nr_active) {
@@ -197,12 +202,11 @@ static void cgrp_refresh_hweight(struct cgroup *cgrp, struct fcg_cgrp_ctx *cgc)
 		return;
 	}
 
-	if (cgc->hweight_gen == hweight_gen) {
+	if (cgc->hweight_gen == gen) {
 		stat_inc(FCG_STAT_HWT_CACHE);
 		return;
 	}
 
-	stat_inc(FCG_STAT_HWT_UPDATES);
 	bpf_for(level, 0, cgrp->level + 1) {
 		struct fcg_cgrp_ctx *cgc;
 		bool is_active;
@@ -213,37 +217,69 @@ static void cgrp_refresh_hweight(struct cgroup *cgrp, struct fcg_cgrp_ctx *cgc)
 
 		if (!level) {
 			cgc->hweight = FCG_HWEIGHT_ONE;
-			cgc->hweight_gen = hweight_gen;
+			cgc->hweight_gen = gen;
 		} else {
 			struct fcg_cgrp_ctx *pcgc;
+			bool hweight_changed = false;
+			u64 pchild_gen;
 
 			pcgc = find_ancestor_cgrp_ctx(cgrp, level - 1);
 			if (!pcgc)
 				break;
 
 			/*
-			 * We can be oppotunistic here and not grab the
-			 * cgv_tree_lock and deal with the occasional races.
-			 * However, hweight updates are already cached and
-			 * relatively low-frequency. Let's just do the
-			 * straightforward thing.
+			 * If neither the parent's hweight nor its
+			 * child_weight_sum changed since @cgc's hweight was
+			 * last calculated, the weight tree change which bumped
+			 * hweight_gen happened in another subtree. Skip
+			 * without grabbing the parent's lock.
+			 *
+			 * ->child_gen is bumped after the inputs are updated.
+			 * Read it before the inputs so that a racing update
+			 * is caught by the next refresh.
+			 */
+			pchild_gen = pcgc->child_gen;
+			if (cgc->pchild_gen == pchild_gen) {
+				cgc->hweight_gen = gen;
+				continue;
+			}
+
+			/*
+			 * We can be oppotunistic here and not grab the parent's
+			 * lock and deal with the occasional races. However,
+			 * hweight updates are already cached and relatively
+			 * low-frequency. Let's just do the straightforward
+			 * thing.
 			 */
-			bpf_spin_lock(&cgv_tree_lock);
+			bpf_spin_lock(&pcgc->lock);
 			is_active = cgc->nr_active;
 			if (is_active) {
-				cgc->hweight_gen = pcgc->hweight_gen;
-				cgc->hweight =
-					div_round_up(pcgc->hweight * cgc->weight,
-						     pcgc->child_weight_sum);
+				u32 hweight = div_round_up(pcgc->hweight * cgc->weight,
+							   pcgc->child_weight_sum);
+
+				cgc->hweight_gen = gen;
+				cgc->pchild_gen = pchild_gen;
+				if (cgc->hweight != hweight) {
+					cgc->hweight = hweight;
+					hweight_changed = true;
+				}
 			}
-			bpf_spin_unlock(&cgv_tree_lock);
+			bpf_spin_unlock(&pcgc->lock);
 
 			if (!is_active) {
 				stat_inc(FCG_STAT_HWT_RACE);
 				break;
 			}
+			if (hweight_changed)
+				__sync_fetch_and_add(&cgc->child_gen, 1);
+			updated = true;
 		}
 	}
+
+	if (updated)
+		stat_inc(FCG_STAT_HWT_UPDATES);
+	else
+		stat_inc(FCG_STAT_HWT_CACHE);
 }
 
 static void cgrp_cap_budget(struct cgv_node *cgv_node, struct fcg_cgrp_ctx *cgc)
@@ -305,16 +341,10 @@ static void cgrp_enqueued(struct cgroup *cgrp, struct fcg_cgrp_ctx *cgc)
 
 void BPF_STRUCT_OPS(fcg_enqueue, struct task_struct *p, u64 enq_flags)
 {
-	struct fcg_task_ctx *taskc;
+	struct fcg_task_ctx *taskc = scx_task_data(p, struct fcg_task_ctx);
 	struct cgroup *cgrp;
 	struct fcg_cgrp_ctx *cgc;
 
-	taskc = bpf_task_storage_get(&task_ctx, p, 0, 0);
-	if (!taskc) {
-		scx_bpf_error("task_ctx lookup failed");
-		return;
-	}
-
 	/*
 	 * If select_cpu_dfl() is recommending local enqueue, the target CPU is
 	 * idle. Follow it and charge the cgroup later in fcg_stopping() after
@@ -356,7 +386,7 @@ void BPF_STRUCT_OPS(fcg_enqueue, struct task_struct *p, u64 enq_flags)
 		goto out_release;
 
 	if (fifo_sched) {
-		scx_bpf_dispatch(p, cgrp->kn->id, SCX_SLICE_DFL, enq_flags);
+		scx_bpf_dispatch(p, SCX_DSQ_CGROUP, SCX_SLICE_DFL, enq_flags);
 	} else {
 		u64 tvtime = p->scx.dsq_vtime;
 
@@ -367,7 +397,7 @@ void BPF_STRUCT_OPS(fcg_enqueue, struct task_struct *p, u64 enq_flags)
 		if (vtime_before(tvtime, cgc->tvtime_now - SCX_SLICE_DFL))
 			tvtime = cgc->tvtime_now - SCX_SLICE_DFL;
 
-		scx_bpf_dispatch_vtime(p, cgrp->kn->id, SCX_SLICE_DFL,
+		scx_bpf_dispatch_vtime(p, SCX_DSQ_CGROUP, SCX_SLICE_DFL,
 				       tvtime, enq_flags);
 	}
 
@@ -395,7 +425,7 @@ static void update_active_weight_sums(struct cgroup *cgrp, bool runnable)
 	 * In most cases, a hot cgroup would have multiple threads going to
 	 * sleep and waking up while the whole cgroup stays active. In leaf
 	 * cgroups, ->nr_runnable which is updated with __sync operations gates
-	 * ->nr_active updates, so that we don't have to grab the cgv_tree_lock
+	 * ->nr_active updates, so that we don't have to grab the parent's lock
 	 * repeatedly for a busy cgroup which is staying active.
 	 */
 	if (runnable) {
@@ -421,48 +451,51 @@ static void update_active_weight_sums(struct cgroup *cgrp, bool runnable)
 	/* propagate upwards */
 	bpf_for(idx, 0, cgrp->level) {
 		int level = cgrp->level - idx;
-		struct fcg_cgrp_ctx *cgc, *pcgc = NULL;
+		struct fcg_cgrp_ctx *cgc, *pcgc;
 		bool propagate = false;
 
+		/* @level is never 0 and the root's ->nr_active isn't tracked */
 		cgc = find_ancestor_cgrp_ctx(cgrp, level);
 		if (!cgc)
 			break;
-		if (level) {
-			pcgc = find_ancestor_cgrp_ctx(cgrp, level - 1);
-			if (!pcgc)
-				break;
-		}
+		pcgc = find_ancestor_cgrp_ctx(cgrp, level - 1);
+		if (!pcgc)
+			break;
 
 		/*
 		 * We need the propagation protected by a lock to synchronize
-		 * against weight changes. There's no reason to drop the lock at
-		 * each level but bpf_spin_lock() doesn't want any function
-		 * calls while locked.
+		 * against weight changes. A cgroup's ->nr_active and its share
+		 * of the parent's ->child_weight_sum are protected by the
+		 * parent's lock, so activations in different parts of the
+		 * hierarchy don't contend with each other or with the cgroup
+		 * picking in try_pick_next_cgroup() which uses cgv_tree_lock.
+		 *
+		 * As only one bpf_spin_lock() can be held at a time, the lock
+		 * is dropped between levels. This is fine as each level only
+		 * depends on the 0 <-> 1 transition of the level below.
 		 */
-		bpf_spin_lock(&cgv_tree_lock);
+		bpf_spin_lock(&pcgc->lock);
 
 		if (runnable) {
 			if (!cgc->nr_active++) {
 				updated = true;
-				if (pcgc) {
-					propagate = true;
-					pcgc->child_weight_sum += cgc->weight;
-				}
+				propagate = true;
+				pcgc->child_weight_sum += cgc->weight;
 			}
 		} else {
 			if (!--cgc->nr_active) {
 				updated = true;
-				if (pcgc) {
-					propagate = true;
-					pcgc->child_weight_sum -= cgc->weight;
-				}
+				propagate = true;
+				pcgc->child_weight_sum -= cgc->weight;
 			}
 		}
 
-		bpf_spin_unlock(&cgv_tree_lock);
+		bpf_spin_unlock(&pcgc->lock);
 
 		if (!propagate)
 			break;
+
+		__sync_fetch_and_add(&pcgc->child_gen, 1);
 	}
 
 	if (updated)
@@ -506,7 +539,7 @@ void BPF_STRUCT_OPS(fcg_running, struct task_struct *p)
 
 void BPF_STRUCT_OPS(fcg_stopping, struct task_struct *p, bool runnable)
 {
-	struct fcg_task_ctx *taskc;
+	struct fcg_task_ctx *taskc = scx_task_data(p, struct fcg_task_ctx);
 	struct cgroup *cgrp;
 	struct fcg_cgrp_ctx *cgc;
 
@@ -515,12 +548,6 @@ void BPF_STRUCT_OPS(fcg_stopping, struct task_struct *p, bool runnable)
 		p->scx.dsq_vtime +=
 			(SCX_SLICE_DFL - p->scx.slice) * 100 / p->scx.weight;
 
-	taskc = bpf_task_storage_get(&task_ctx, p, 0, 0);
-	if (!taskc) {
-		scx_bpf_error("task_ctx lookup failed");
-		return;
-	}
-
 	if (!taskc->bypassed_at)
 		return;
 
@@ -545,23 +572,35 @@ void BPF_STRUCT_OPS(fcg_quiescent, struct task_struct *p, u64 deq_flags)
 
 void BPF_STRUCT_OPS(fcg_cgroup_set_weight, struct cgroup *cgrp, u32 weight)
 {
-	struct fcg_cgrp_ctx *cgc, *pcgc = NULL;
+	struct fcg_cgrp_ctx *cgc, *pcgc;
+	bool updated = false;
 
 	cgc = find_cgrp_ctx(cgrp);
 	if (!cgc)
 		return;
 
-	if (cgrp->level) {
-		pcgc = find_ancestor_cgrp_ctx(cgrp, cgrp->level - 1);
-		if (!pcgc)
-			return;
+	/* the root's weight doesn't participate in any weight sum */
+	if (!cgrp->level) {
+		cgc->weight = weight;
+		return;
 	}
 
-	bpf_spin_lock(&cgv_tree_lock);
-	if (pcgc && cgc->nr_active)
+	pcgc = find_ancestor_cgrp_ctx(cgrp, cgrp->level - 1);
+	if (!pcgc)
+		return;
+
+	bpf_spin_lock(&pcgc->lock);
+	if (cgc->nr_active) {
 		pcgc->child_weight_sum += (s64)weight - cgc->weight;
+		updated = true;
+	}
 	cgc->weight = weight;
-	bpf_spin_unlock(&cgv_tree_lock);
+	bpf_spin_unlock(&pcgc->lock);
+
+	if (updated) {
+		__sync_fetch_and_add(&pcgc->child_gen, 1);
+		__sync_fetch_and_add(&hweight_gen, 1);
+	}
 }
 
 static bool try_pick_next_cgroup(u64 *cgidp)
@@ -572,6 +611,7 @@ static bool try_pick_next_cgroup(u64 *cgidp)
 	struct fcg_cgrp_ctx *cgc;
 	struct cgroup *cgrp;
 	u64 cgid;
+	s32 nr_queued;
 
 	/* pop the front cgroup and wind cvtime_now accordingly */
 	bpf_spin_lock(&cgv_tree_lock);
@@ -620,8 +660,7 @@ static bool try_pick_next_cgroup(u64 *cgidp)
 		goto out_free;
 	}
 
-	if (!scx_bpf_consume(cgid)) {
-		bpf_cgroup_release(cgrp);
+	if (!scx_bpf_consume_cgroup(cgrp)) {
 		stat_inc(FCG_STAT_PNC_EMPTY);
 		goto out_stash;
 	}
@@ -651,12 +690,6 @@ static bool try_pick_next_cgroup(u64 *cgidp)
 	return true;
 
 out_stash:
-	stash = bpf_map_lookup_elem(&cgv_node_stash, &cgid);
-	if (!stash) {
-		stat_inc(FCG_STAT_PNC_GONE);
-		goto out_free;
-	}
-
 	/*
 	 * Paired with cmpxchg in cgrp_enqueued(). If they see the following
 	 * transition, they'll enqueue the cgroup. If they are earlier, we'll
@@ -664,7 +697,16 @@ static bool try_pick_next_cgroup(u64 *cgidp)
 	 */
 	__sync_val_compare_and_swap(&cgc->queued, 1, 0);
 
-	if (scx_bpf_dsq_nr_queued(cgid)) {
+	nr_queued = scx_bpf_cgroup_dsq_nr_queued(cgrp);
+	bpf_cgroup_release(cgrp);
+
+	stash = bpf_map_lookup_elem(&cgv_node_stash, &cgid);
+	if (!stash) {
+		stat_inc(FCG_STAT_PNC_GONE);
+		goto out_free;
+	}
+
+	if (nr_queued > 0) {
 		bpf_spin_lock(&cgv_tree_lock);
 		bpf_rbtree_add(&cgv_tree, &cgv_node->rb_node, cgv_node_less);
 		bpf_spin_unlock(&cgv_tree_lock);
@@ -683,22 +725,44 @@ static bool try_pick_next_cgroup(u64 *cgidp)
 	return false;
 }
 
+static void set_cpu_cgrp(struct fcg_cpu_cgrp *cpucg, u64 cgid)
+{
+	struct cgroup *cgrp = NULL;
+
+	if (cgid)
+		cgrp = bpf_cgroup_from_id(cgid);
+
+	cgrp = bpf_kptr_xchg(&cpucg->cgrp, cgrp);
+	if (cgrp)
+		bpf_cgroup_release(cgrp);
+}
+
 void BPF_STRUCT_OPS(fcg_dispatch, s32 cpu, struct task_struct *prev)
 {
 	struct fcg_cpu_ctx *cpuc;
+	struct fcg_cpu_cgrp *cpucg;
 	struct fcg_cgrp_ctx *cgc;
 	struct cgroup *cgrp;
 	u64 now = bpf_ktime_get_ns();
+	u32 idx = 0;
 
-	cpuc = find_cpu_ctx();
+	cpuc = find_cpu_ctx(cpu);
 	if (!cpuc)
 		return;
 
+	cpucg = bpf_map_lookup_elem(&cpu_cgrp, &idx);
+	if (!cpucg) {
+		scx_bpf_error("cpu_cgrp lookup failed");
+		return;
+	}
+
 	if (!cpuc->cur_cgid)
 		goto pick_next_cgroup;
 
 	if (vtime_before(now, cpuc->cur_at + cgrp_slice_ns)) {
-		if (scx_bpf_consume(cpuc->cur_cgid)) {
+		/* %NULL if the cgroup was already gone when it was picked */
+		cgrp = cpucg->cgrp;
+		if (cgrp && scx_bpf_consume_cgroup(cgrp)) {
 			stat_inc(FCG_STAT_CNS_KEEP);
 			return;
 		}
@@ -707,16 +771,16 @@ void BPF_STRUCT_OPS(fcg_dispatch, s32 cpu, struct task_struct *prev)
 		stat_inc(FCG_STAT_CNS_EXPIRE);
 	}
 
-	/*
-	 * The current cgroup is expiring. It was already charged a full slice.
-	 * Calculate the actual usage and accumulate the delta.
-	 */
 	cgrp = bpf_cgroup_from_id(cpuc->cur_cgid);
 	if (!cgrp) {
 		stat_inc(FCG_STAT_CNS_GONE);
 		goto pick_next_cgroup;
 	}
 
+	/*
+	 * The current cgroup is expiring. It was already charged a full slice.
+	 * Calculate the actual usage and accumulate the delta.
+	 */
 	cgc = bpf_cgrp_storage_get(&cgrp_ctx, cgrp, 0, 0);
 	if (cgc) {
 		/*
@@ -740,32 +804,21 @@ void BPF_STRUCT_OPS(fcg_dispatch, s32 cpu, struct task_struct *prev)
 
 	if (scx_bpf_consume(SCX_DSQ_GLOBAL)) {
 		cpuc->cur_cgid = 0;
-		return;
+	} else {
+		bpf_repeat(BPF_MAX_LOOPS) {
+			if (try_pick_next_cgroup(&cpuc->cur_cgid))
+				break;
+		}
 	}
 
-	bpf_repeat(BPF_MAX_LOOPS) {
-		if (try_pick_next_cgroup(&cpuc->cur_cgid))
-			break;
-	}
+	set_cpu_cgrp(cpucg, cpuc->cur_cgid);
 }
 
 s32 BPF_STRUCT_OPS(fcg_prep_enable, struct task_struct *p,
 		   struct scx_enable_args *args)
 {
-	struct fcg_task_ctx *taskc;
 	struct fcg_cgrp_ctx *cgc;
 
-	/*
-	 * @p is new. Let's ensure that its task_ctx is available. We can sleep
-	 * in this function and the following will automatically use GFP_KERNEL.
-	 */
-	taskc = bpf_task_storage_get(&task_ctx, p, 0,
-				     BPF_LOCAL_STORAGE_GET_F_CREATE);
-	if (!taskc)
-		return -ENOMEM;
-
-	taskc->bypassed_at = 0;
-
 	if (!(cgc = find_cgrp_ctx(args->cgroup)))
 		return -ENOENT;
 
@@ -783,24 +836,15 @@ int BPF_STRUCT_OPS_SLEEPABLE(fcg_cgroup_init, struct cgroup *cgrp,
 	u64 cgid = cgrp->kn->id;
 	int ret;
 
-	/*
-	 * Technically incorrect as cgroup ID is full 64bit while dq ID is
-	 * 63bit. Should not be a problem in practice and easy to spot in the
-	 * unlikely case that it breaks.
-	 */
-	ret = scx_bpf_create_dsq(cgid, -1);
-	if (ret)
-		return ret;
-
 	cgc = bpf_cgrp_storage_get(&cgrp_ctx, cgrp, 0,
 				   BPF_LOCAL_STORAGE_GET_F_CREATE);
-	if (!cgc) {
-		ret = -ENOMEM;
-		goto err_destroy_dsq;
-	}
+	if (!cgc)
+		return -ENOMEM;
 
 	cgc->weight = args->weight;
 	cgc->hweight = FCG_HWEIGHT_ONE;
+	/* children start with pchild_gen 0 and must calculate their hweights */
+	cgc->child_gen = 1;
 
 	ret = bpf_map_update_elem(&cgv_node_stash, &cgid, &empty_stash,
 				  BPF_NOEXIST);
@@ -808,14 +852,13 @@ int BPF_STRUCT_OPS_SLEEPABLE(fcg_cgroup_init, struct cgroup *cgrp,
 		if (ret != -ENOMEM)
 			scx_bpf_error("unexpected stash creation error (%d)",
 				      ret);
-		goto err_destroy_dsq;
+		return ret;
 	}
 
 	stash = bpf_map_lookup_elem(&cgv_node_stash, &cgid);
 	if (!stash) {
 		scx_bpf_error("unexpected cgv_node stash lookup failure");
-		ret = -ENOENT;
-		goto err_destroy_dsq;
+		return -ENOENT;
 	}
 
 	cgv_node = bpf_obj_new(struct cgv_node);
@@ -840,8 +883,6 @@ int BPF_STRUCT_OPS_SLEEPABLE(fcg_cgroup_init, struct cgroup *cgrp,
 	bpf_obj_drop(cgv_node);
 err_del_cgv_node:
 	bpf_map_delete_elem(&cgv_node_stash, &cgid);
-err_destroy_dsq:
-	scx_bpf_destroy_dsq(cgid);
 	return ret;
 }
 
@@ -855,7 +896,6 @@ void BPF_STRUCT_OPS(fcg_cgroup_exit, struct cgroup *cgrp)
 	 * off the front of the tree.
 	 */
 	bpf_map_delete_elem(&cgv_node_stash, &cgid);
-	scx_bpf_destroy_dsq(cgid);
 }
 
 void BPF_STRUCT_OPS(fcg_cgroup_move, struct task_struct *p,
@@ -899,6 +939,8 @@ struct sched_ext_ops flatcg_ops = {
 	.cgroup_move		= (void *)fcg_cgroup_move,
 	.init			= (void *)fcg_init,
 	.exit			= (void *)fcg_exit,
-	.flags			= SCX_OPS_CGROUP_KNOB_WEIGHT | SCX_OPS_ENQ_EXITING,
+	.flags			= SCX_OPS_CGROUP_KNOB_WEIGHT | SCX_OPS_ENQ_EXITING |
+				  SCX_OPS_CGROUP_DSQ,
+	.cpu_ctx_size		= sizeof(struct fcg_cpu_ctx),
 	.name			= "flatcg",
 };
@@ -14,6 +14,7 @@
 #include <assert.h>
 #include <bpf/bpf.h>
 #include "user_exit_info.h"
+#include "scx_stats.h"
 #include "scx_flatcg.h"
 #include "scx_flatcg.skel.h"
 
@@ -26,14 +27,37 @@ const char help_fmt[] =
 "\n"
 "See the top-level comment in .bpf.c for more details.\n"
 "\n"
-"Usage: %s [-s SLICE_US] [-i INTERVAL] [-f] [-p]\n"
+"Usage: %s [-s SLICE_US] [-i INTERVAL] [-f] [-p] [-S]\n"
 "\n"
 "  -s SLICE_US   Override slice duration\n"
 "  -i INTERVAL   Report interval\n"
 "  -f            Use FIFO scheduling instead of weighted vtime scheduling\n"
 "  -p            Switch only tasks on SCHED_EXT policy intead of all\n"
+"  -S            Print statistics in the machine-readable scx_stats format\n"
 "  -h            Display this help and exit\n";
 
+static const char * const fcg_stat_names[FCG_NR_STATS] = {
+	[FCG_STAT_ACT]		= "act",
+	[FCG_STAT_DEACT]	= "deact",
+	[FCG_STAT_LOCAL]	= "local",
+	[FCG_STAT_GLOBAL]	= "global",
+	[FCG_STAT_HWT_UPDATES]	= "hwt_updates",
+	[FCG_STAT_HWT_CACHE]	= "hwt_cache",
+	[FCG_STAT_HWT_SKIP]	= "hwt_skip",
+	[FCG_STAT_HWT_RACE]	= "hwt_race",
+	[FCG_STAT_ENQ_SKIP]	= "enq_skip",
+	[FCG_STAT_ENQ_RACE]	= "enq_race",
+	[FCG_STAT_CNS_KEEP]	= "cns_keep",
+	[FCG_STAT_CNS_EXPIRE]	= "cns_expire",
+	[FCG_STAT_CNS_EMPTY]	= "cns_empty",
+	[FCG_STAT_CNS_GONE]	= "cns_gone",
+	[FCG_STAT_PNC_NO_CGRP]	= "pnc_no_cgrp",
+	[FCG_STAT_PNC_NEXT]	= "pnc_next",
+	[FCG_STAT_PNC_EMPTY]	= "pnc_empty",
+	[FCG_STAT_PNC_GONE]	= "pnc_gone",
+	[FCG_STAT_BAD_REMOVAL]	= "bad_removal",
+};
+
 static volatile int exit_req;
 
 static void sigint_handler(int dummy)
@@ -91,31 +115,13 @@ static float read_cpu_util(__u64 *last_sum, __u64 *last_idle)
 	return delta_sum ? (float)(delta_sum - delta_idle) / delta_sum : 0.0;
 }
 
-static void fcg_read_stats(struct scx_flatcg *skel, __u64 *stats)
-{
-	__u64 cnts[FCG_NR_STATS][skel->rodata->nr_cpus];
-	__u32 idx;
-
-	memset(stats, 0, sizeof(stats[0]) * FCG_NR_STATS);
-
-	for (idx = 0; idx < FCG_NR_STATS; idx++) {
-		int ret, cpu;
-
-		ret = bpf_map_lookup_elem(bpf_map__fd(skel->maps.stats),
-					  &idx, cnts[idx]);
-		if (ret < 0)
-			continue;
-		for (cpu = 0; cpu < skel->rodata->nr_cpus; cpu++)
-			stats[idx] += cnts[idx][cpu];
-	}
-}
-
 int main(int argc, char **argv)
 {
 	struct scx_flatcg *skel;
 	struct bpf_link *link;
 	struct timespec intv_ts = { .tv_sec = 2, .tv_nsec = 0 };
-	bool dump_cgrps = false;
+	struct scx_stats st;
+	bool dump_cgrps = false, print_scx_stats = false;
 	__u64 last_cpu_sum = 0, last_cpu_idle = 0;
 	__u64 last_stats[FCG_NR_STATS] = {};
 	unsigned long seq = 0;
@@ -134,7 +140,13 @@ int main(int argc, char **argv)
 
 	skel->rodata->nr_cpus = libbpf_num_possible_cpus();
 
-	while ((opt = getopt(argc, argv, "s:i:dfph")) != -1) {
+	if (scx_stats_init(&st, skel->maps.scx_stats, fcg_stat_names,
+			   FCG_NR_STATS)) {
+		fprintf(stderr, "Failed to init stats\n");
+		return 1;
+	}
+
+	while ((opt = getopt(argc, argv, "s:i:dfpSh")) != -1) {
 		double v;
 
 		switch (opt) {
@@ -156,6 +168,9 @@ int main(int argc, char **argv)
 		case 'p':
 			skel->rodata->switch_partial = true;
 			break;
+		case 'S':
+			print_scx_stats = true;
+			break;
 		case 'h':
 		default:
 			fprintf(stderr, help_fmt, basename(argv[0]));
@@ -163,16 +178,22 @@ int main(int argc, char **argv)
 		}
 	}
 
-	printf("slice=%.1lfms intv=%.1lfs dump_cgrps=%d",
-	       (double)skel->rodata->cgrp_slice_ns / 1000000.0,
-	       (double)intv_ts.tv_sec + (double)intv_ts.tv_nsec / 1000000000.0,
-	       dump_cgrps);
+	if (!print_scx_stats)
+		printf("slice=%.1lfms intv=%.1lfs dump_cgrps=%d",
+		       (double)skel->rodata->cgrp_slice_ns / 1000000.0,
+		       (double)intv_ts.tv_sec + (double)intv_ts.tv_nsec / 1000000000.0,
+		       dump_cgrps);
 
 	if (scx_flatcg__load(skel)) {
 		fprintf(stderr, "Failed to load: %s\n", strerror(errno));
 		return 1;
 	}
 
+	if (scx_stats_mmap(&st)) {
+		fprintf(stderr, "Failed to mmap stats: %s\n", strerror(errno));
+		return 1;
+	}
+
 	link = bpf_map__attach_struct_ops(skel->maps.flatcg_ops);
 	if (!link) {
 		fprintf(stderr, "Failed to attach_struct_ops: %s\n",
@@ -188,12 +209,18 @@ int main(int argc, char **argv)
 
 		cpu_util = read_cpu_util(&last_cpu_sum, &last_cpu_idle);
 
-		fcg_read_stats(skel, acc_stats);
+		scx_stats_read(&st, acc_stats);
 		for (i = 0; i < FCG_NR_STATS; i++)
 			stats[i] = acc_stats[i] - last_stats[i];
 
 		memcpy(last_stats, acc_stats, sizeof(acc_stats));
 
+		if (print_scx_stats) {
+			scx_stats_print(&st, acc_stats, "flatcg", stdout);
+			nanosleep(&intv_ts, NULL);
+			continue;
+		}
+
 		printf("\n[SEQ %6lu cpu=%5.1lf hweight_gen=%lu]\n",
 		       seq++, cpu_util * 100.0, skel->data->hweight_gen);
 		printf("       act:%6llu  deact:%6llu local:%6llu global:%6llu\n",
@@ -227,6 +254,7 @@ int main(int argc, char **argv)
 
 	bpf_link__destroy(link);
 	uei_print(&skel->bss->uei);
+	scx_stats_munmap(&st);
 	scx_flatcg__destroy(skel);
 	return 0;
 }
@@ -35,6 +35,8 @@ enum fcg_stat_idx {
 };
 
 struct fcg_cgrp_ctx {
+	/* protects the children's ->nr_active and ->weight, and ->child_weight_sum */
+	struct bpf_spin_lock	lock;
 	u32			nr_active;
 	u32			nr_runnable;
 	u32			queued;
@@ -42,6 +44,8 @@ struct fcg_cgrp_ctx {
 	u32			hweight;
 	u64			child_weight_sum;
 	u64			hweight_gen;
+	u64			child_gen;	/* inc'd when children's hweights need updating */
+	u64			pchild_gen;	/* parent's child_gen @hweight was calculated with */
 	s64			cvtime_delta;
 	u64			tvtime_now;
 };
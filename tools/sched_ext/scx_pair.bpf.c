@@ -169,6 +169,7 @@ struct {
 /* queue of cgrp_q's possibly with tasks on them */
 struct {
 	__uint(type, BPF_MAP_TYPE_QUEUE);
+	__uint(map_flags, BPF_F_QUEUE_MPMC);
 	/*
 	 * Because it's difficult to build strong synchronization encompassing
 	 * multiple non-trivial operations in BPF, this queue is managed in an
@@ -184,6 +185,7 @@ struct {
 /* per-cgroup q which FIFOs the tasks from the cgroup */
 struct cgrp_q {
 	__uint(type, BPF_MAP_TYPE_QUEUE);
+	__uint(map_flags, BPF_F_QUEUE_MPMC);
 	__uint(max_entries, MAX_QUEUED);
 	__type(value, u32);
 };
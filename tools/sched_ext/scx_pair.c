@@ -40,6 +40,8 @@ int main(int argc, char **argv)
 	struct bpf_link *link;
 	u64 seq = 0;
 	s32 stride, i, opt, outer_fd;
+	LIBBPF_OPTS(bpf_map_create_opts, inner_opts,
+		    .map_flags = BPF_F_QUEUE_MPMC);
 
 	signal(SIGINT, sigint_handler);
 	signal(SIGTERM, sigint_handler);
@@ -119,7 +121,7 @@ int main(int argc, char **argv)
 			break;
 
 		inner_fd = bpf_map_create(BPF_MAP_TYPE_QUEUE, NULL, 0,
-					  sizeof(u32), MAX_QUEUED, NULL);
+					  sizeof(u32), MAX_QUEUED, &inner_opts);
 		assert(inner_fd >= 0);
 		assert(!bpf_map_update_elem(outer_fd, &i, &inner_fd, BPF_ANY));
 		close(inner_fd);
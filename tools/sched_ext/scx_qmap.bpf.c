@@ -5,7 +5,9 @@
  * There are five FIFOs implemented using BPF_MAP_TYPE_QUEUE. A task gets
  * assigned to one depending on its compound weight. Each CPU round robins
  * through the FIFOs and dispatches more from FIFOs with higher indices - 1 from
- * queue0, 2 from queue1, 4 from queue2 and so on.
+ * queue0, 2 from queue1, 4 from queue2 and so on. The queues are created with
+ * BPF_F_QUEUE_MPMC so that enqueueing and dispatching CPUs don't serialize on
+ * the map locks.
  *
  * This scheduler demonstrates:
  *
@@ -40,6 +42,7 @@ struct user_exit_info uei;
 
 struct qmap {
 	__uint(type, BPF_MAP_TYPE_QUEUE);
+	__uint(map_flags, BPF_F_QUEUE_MPMC);
 	__uint(max_entries, 4096);
 	__type(value, u32);
 } queue0 SEC(".maps"),
@@ -6,6 +6,7 @@
  */
 #define _GNU_SOURCE
 #include <stdio.h>
+#include <errno.h>
 #include <unistd.h>
 #include <signal.h>
 #include <assert.h>
@@ -23,15 +24,66 @@ const char help_fmt[] =
 "\n"
 "  -f            Use FIFO scheduling instead of weighted vtime scheduling\n"
 "  -p            Switch only tasks on SCHED_EXT policy intead of all\n"
-"  -h            Display this help and exit\n";
+"  -h            Display this help and exit\n"
+"\n"
+"Send SIGUSR1 to toggle between FIFO and weighted vtime scheduling without\n"
+"unloading the scheduler.\n";
 
 static volatile int exit_req;
+static volatile int toggle_req;
 
 static void sigint_handler(int simple)
 {
 	exit_req = 1;
 }
 
+static void sigusr1_handler(int simple)
+{
+	toggle_req = 1;
+}
+
+/*
+ * Load a copy of @skel with fifo_sched flipped and swap its programs in. As
+ * fifo_sched is rodata, the verifier prunes the branches for the other mode
+ * from the new programs. All maps other than .rodata are shared so that the
+ * scheduler state carries over. Returns the new skeleton or NULL on failure in
+ * which case @skel stays in use.
+ */
+static struct scx_simple *respecialize(struct scx_simple *skel,
+				       struct bpf_link *link)
+{
+	struct scx_simple *nskel;
+	struct bpf_map *map;
+
+	nskel = scx_simple__open();
+	if (!nskel)
+		return NULL;
+
+	*nskel->rodata = *skel->rodata;
+	nskel->rodata->fifo_sched = !skel->rodata->fifo_sched;
+
+	bpf_object__for_each_map(map, nskel->obj) {
+		struct bpf_map *omap;
+
+		if (map == nskel->maps.rodata ||
+		    bpf_map__type(map) == BPF_MAP_TYPE_STRUCT_OPS)
+			continue;
+		omap = bpf_object__find_map_by_name(skel->obj,
+						    bpf_map__name(map));
+		if (!omap || bpf_map__reuse_fd(map, bpf_map__fd(omap)))
+			goto err;
+	}
+
+	if (scx_simple__load(nskel) ||
+	    bpf_link__update_map(link, nskel->maps.simple_ops))
+		goto err;
+
+	return nskel;
+err:
+	scx_simple__destroy(nskel);
+	return NULL;
+}
+
 static void read_stats(struct scx_simple *skel, u64 *stats)
 {
 	int nr_cpus = libbpf_num_possible_cpus();
@@ -60,6 +112,7 @@ int main(int argc, char **argv)
 
 	signal(SIGINT, sigint_handler);
 	signal(SIGTERM, sigint_handler);
+	signal(SIGUSR1, sigusr1_handler);
 
 	libbpf_set_strict_mode(LIBBPF_STRICT_ALL);
 
@@ -88,6 +141,22 @@ int main(int argc, char **argv)
 	while (!exit_req && !uei_exited(&skel->bss->uei)) {
 		u64 stats[2];
 
+		if (toggle_req) {
+			struct scx_simple *nskel;
+
+			toggle_req = 0;
+			nskel = respecialize(skel, link);
+			if (nskel) {
+				scx_simple__destroy(skel);
+				skel = nskel;
+				printf("switched to %s scheduling\n",
+				       skel->rodata->fifo_sched ? "FIFO" : "vtime");
+			} else {
+				fprintf(stderr, "Failed to respecialize: %s\n",
+					strerror(errno));
+			}
+		}
+
 		read_stats(skel, stats);
 		printf("local=%lu global=%lu\n", stats[0], stats[1]);
 		fflush(stdout);
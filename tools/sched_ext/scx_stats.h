@@ -0,0 +1,165 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Define per-CPU statistics counters which are shared between BPF and
+ * userspace parts of a scheduler.
+ *
+ * The counters live in a BPF_F_MMAPABLE array map indexed by CPU. Each CPU
+ * owns a cacheline-aligned struct scx_stats_cpu so that the BPF side can bump
+ * its counters without atomics or false sharing, and the userspace side reads
+ * them through a shared mapping without issuing any syscalls.
+ *
+ * Each scheduler defines its own counter indices (< SCX_STATS_MAX_CNTS) and a
+ * matching array of names which is used when printing.
+ *
+ * Copyright (c) 2023 Meta Platforms, Inc. and affiliates.
+ */
+#ifndef __SCX_STATS_H
+#define __SCX_STATS_H
+
+enum {
+	SCX_STATS_MAX_CNTS	= 32,
+};
+
+struct scx_stats_cpu {
+	__u64		cnts[SCX_STATS_MAX_CNTS];
+} __attribute__((aligned(64)));
+
+#ifdef __bpf__
+
+/*
+ * max_entries is set to the number of possible CPUs by scx_stats_init() before
+ * the skeleton is loaded.
+ */
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, struct scx_stats_cpu);
+	__uint(max_entries, 1);
+} scx_stats SEC(".maps");
+
+static inline void scx_stat_add(u32 idx, u64 delta)
+{
+	u32 cpu = bpf_get_smp_processor_id();
+	struct scx_stats_cpu *sc;
+
+	sc = bpf_map_lookup_elem(&scx_stats, &cpu);
+	if (sc && idx < SCX_STATS_MAX_CNTS)
+		sc->cnts[idx] += delta;
+}
+
+static inline void scx_stat_inc(u32 idx)
+{
+	scx_stat_add(idx, 1);
+}
+
+#else	/* !__bpf__ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <bpf/libbpf.h>
+
+struct scx_stats {
+	struct bpf_map			*map;
+	const char * const		*names;
+	__u32				nr_cnts;
+	__u32				nr_cpus;
+	const volatile struct scx_stats_cpu *cpus;
+	size_t				mmap_sz;
+};
+
+/**
+ * scx_stats_init - Initialize @st for @map, must be called before loading
+ * @st: stats to initialize
+ * @map: the scx_stats map of the opened skeleton
+ * @names: names of the counters
+ * @nr_cnts: number of counters, must not be larger than %SCX_STATS_MAX_CNTS
+ */
+static inline int scx_stats_init(struct scx_stats *st, struct bpf_map *map,
+				 const char * const *names, __u32 nr_cnts)
+{
+	int nr_cpus = libbpf_num_possible_cpus();
+
+	if (nr_cpus <= 0 || nr_cnts > SCX_STATS_MAX_CNTS)
+		return -EINVAL;
+
+	memset(st, 0, sizeof(*st));
+	st->map = map;
+	st->names = names;
+	st->nr_cnts = nr_cnts;
+	st->nr_cpus = nr_cpus;
+
+	return bpf_map__set_max_entries(map, nr_cpus);
+}
+
+/**
+ * scx_stats_mmap - Map the counters, must be called after loading
+ * @st: stats to map
+ */
+static inline int scx_stats_mmap(struct scx_stats *st)
+{
+	long page_sz = sysconf(_SC_PAGESIZE);
+	void *p;
+
+	st->mmap_sz = sizeof(struct scx_stats_cpu) * st->nr_cpus;
+	st->mmap_sz = (st->mmap_sz + page_sz - 1) / page_sz * page_sz;
+
+	p = mmap(NULL, st->mmap_sz, PROT_READ, MAP_SHARED,
+		 bpf_map__fd(st->map), 0);
+	if (p == MAP_FAILED)
+		return -errno;
+
+	st->cpus = p;
+	return 0;
+}
+
+static inline void scx_stats_munmap(struct scx_stats *st)
+{
+	if (st->cpus)
+		munmap((void *)st->cpus, st->mmap_sz);
+	st->cpus = NULL;
+}
+
+/**
+ * scx_stats_read - Read the counters summed over all CPUs
+ * @st: stats to read
+ * @cnts: output array of @st->nr_cnts counters
+ */
+static inline void scx_stats_read(const struct scx_stats *st, __u64 *cnts)
+{
+	__u32 cpu, idx;
+
+	memset(cnts, 0, sizeof(cnts[0]) * st->nr_cnts);
+
+	for (cpu = 0; cpu < st->nr_cpus; cpu++)
+		for (idx = 0; idx < st->nr_cnts; idx++)
+			cnts[idx] += st->cpus[cpu].cnts[idx];
+}
+
+/**
+ * scx_stats_print - Print counters in the common machine-readable format
+ * @st: stats the counters were read from
+ * @cnts: counters to print
+ * @sched: name of the scheduler
+ * @f: output stream
+ *
+ * Prints one "scx_<sched>_<name> <value>" line per counter followed by an
+ * empty line, which can be consumed directly by line-oriented scrapers.
+ */
+static inline void scx_stats_print(const struct scx_stats *st,
+				   const __u64 *cnts, const char *sched,
+				   FILE *f)
+{
+	__u32 idx;
+
+	for (idx = 0; idx < st->nr_cnts; idx++)
+		fprintf(f, "scx_%s_%s %llu\n", sched, st->names[idx],
+			(unsigned long long)cnts[idx]);
+	fputs("\n", f);
+	fflush(f);
+}
+
+#endif	/* __bpf__ */
+#endif	/* __SCX_STATS_H */
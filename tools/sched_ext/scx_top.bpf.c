@@ -0,0 +1,178 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Snapshot collector for scx_top.
+ *
+ * This isn't a scheduler. It's a pair of sched_ext iterators which userspace
+ * runs once per refresh. The DSQ iterator records the depth of each DSQ and
+ * how long its head task has been runnable. The task iterator accounts every
+ * queued task to its cgroup together with how long it has been runnable and
+ * tasks which are queued on the BPF side rather than on a DSQ to the "bpf"
+ * pseudo DSQ. At the end of the task walk, the per-CPU local DSQ depths and
+ * whether each CPU is idle are read directly from the runqueues.
+ *
+ * Results are tagged with the generation number userspace sets before each
+ * walk, so entries which weren't touched by the latest walk are stale and are
+ * reset on the next update. The hash maps are LRU so that entries for DSQs
+ * and cgroups which went away eventually get recycled.
+ *
+ * Copyright (c) 2023 Meta Platforms, Inc. and affiliates.
+ */
+#include "scx_common.bpf.h"
+#include "scx_top.h"
+
+char _license[] SEC("license") = "GPL";
+
+const volatile u32 nr_cpus = 1;		/* !0 for veristat, set during init */
+
+u64 gen;
+
+extern const struct rq runqueues __ksym;
+extern int CONFIG_HZ __kconfig;
+
+/* mmap'd by userspace, max_entries is set to the number of CPUs during init */
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, struct top_cpu_stat);
+	__uint(max_entries, 1);
+} cpu_stats SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__type(key, u64);
+	__type(value, struct top_dsq_stat);
+	__uint(max_entries, TOP_MAX_DSQS);
+} dsq_stats SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__type(key, u64);
+	__type(value, struct top_cgrp_stat);
+	__uint(max_entries, TOP_MAX_CGRPS);
+} cgrp_stats SEC(".maps");
+
+static u64 jiffies_to_ms(u64 j)
+{
+	return j * 1000 / CONFIG_HZ;
+}
+
+static void account_dsq(u64 dsq_id, u32 nr, u64 age_ms)
+{
+	struct top_dsq_stat *ds, init = { .gen = gen };
+
+	ds = bpf_map_lookup_elem(&dsq_stats, &dsq_id);
+	if (!ds) {
+		bpf_map_update_elem(&dsq_stats, &dsq_id, &init, BPF_NOEXIST);
+		ds = bpf_map_lookup_elem(&dsq_stats, &dsq_id);
+		if (!ds)
+			return;
+	}
+
+	if (ds->gen != gen) {
+		ds->gen = gen;
+		ds->nr = 0;
+		ds->head_age_ms = 0;
+	}
+
+	ds->nr += nr;
+	if (age_ms > ds->head_age_ms)
+		ds->head_age_ms = age_ms;
+}
+
+static void account_cgrp(u64 cgid, u64 delay_ms)
+{
+	struct top_cgrp_stat *cs, init = { .gen = gen };
+
+	cs = bpf_map_lookup_elem(&cgrp_stats, &cgid);
+	if (!cs) {
+		bpf_map_update_elem(&cgrp_stats, &cgid, &init, BPF_NOEXIST);
+		cs = bpf_map_lookup_elem(&cgrp_stats, &cgid);
+		if (!cs)
+			return;
+	}
+
+	if (cs->gen != gen) {
+		cs->gen = gen;
+		cs->nr = 0;
+		cs->sum_delay_ms = 0;
+		cs->max_delay_ms = 0;
+	}
+
+	cs->nr++;
+	cs->sum_delay_ms += delay_ms;
+	if (delay_ms > cs->max_delay_ms)
+		cs->max_delay_ms = delay_ms;
+}
+
+static void collect_cpus(void)
+{
+	s32 cpu;
+
+	bpf_for(cpu, 0, nr_cpus) {
+		struct top_cpu_stat *cs;
+		struct rq *rq;
+		u32 idx = cpu;
+
+		rq = bpf_per_cpu_ptr(&runqueues, cpu);
+		cs = bpf_map_lookup_elem(&cpu_stats, &idx);
+		if (!rq || !cs)
+			continue;
+
+		cs->gen = gen;
+		cs->local_nr = rq->scx.local_dsq.nr;
+		cs->nr_running = rq->scx.nr_running;
+		cs->idle = BPF_CORE_READ(rq, curr, pid) == 0;
+	}
+}
+
+SEC("iter/sched_ext_dsq")
+int scx_top_dsq_iter(struct bpf_iter__sched_ext_dsq *ctx)
+{
+	struct scx_dispatch_q *dsq = ctx->dsq;
+	struct scx_dsq_peek_info *head = ctx->head;
+	u64 age_ms = 0;
+
+	/* local DSQs are reported per CPU */
+	if (!dsq || dsq->id == SCX_DSQ_LOCAL)
+		return 0;
+
+	if (head)
+		age_ms = jiffies_to_ms(bpf_jiffies64() - head->runnable_at);
+
+	account_dsq(dsq->id, dsq->nr, age_ms);
+	return 0;
+}
+
+SEC("iter/sched_ext_task")
+int scx_top_task_iter(struct bpf_iter__sched_ext_task *ctx)
+{
+	struct task_struct *p = ctx->task;
+	u64 age_ms;
+
+	/* called with NULL @p once at the end of the walk */
+	if (!p) {
+		collect_cpus();
+		return 0;
+	}
+
+	if (!(p->scx.flags & SCX_TASK_QUEUED))
+		return 0;
+
+	/*
+	 * %SCX_TASK_QUEUED is also set while @p is running. Only count tasks
+	 * which are waiting, either on a DSQ or on the BPF side.
+	 */
+	if (!p->scx.dsq &&
+	    (p->scx.ops_state.counter & SCX_OPSS_STATE_MASK) != SCX_OPSS_QUEUED)
+		return 0;
+
+	age_ms = jiffies_to_ms(bpf_jiffies64() - p->scx.runnable_at);
+
+	/* DSQs are covered by the DSQ iterator */
+	if (!p->scx.dsq)
+		account_dsq(SCX_DSQ_INVALID, 1, age_ms);
+
+	account_cgrp(BPF_CORE_READ(p, cgroups, dfl_cgrp, kn, id), age_ms);
+	return 0;
+}
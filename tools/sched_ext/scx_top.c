@@ -0,0 +1,266 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Copyright (c) 2023 Meta Platforms, Inc. and affiliates.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <libgen.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <bpf/bpf.h>
+#include "scx_top.h"
+#include "scx_top.skel.h"
+
+const char help_fmt[] =
+"A top-like live monitor for sched_ext.\n"
+"\n"
+"Shows the local DSQ depth and idle state of each CPU, the length and the\n"
+"head task's wait time of each non-local DSQ and the queueing delay of each\n"
+"cgroup.\n"
+"Cgroups are identified by their IDs, which match the inode numbers of the\n"
+"cgroup directories. \"bpf\" is the set of tasks queued on the BPF side.\n"
+"\n"
+"Usage: %s [-i INTERVAL] [-n ROWS] [-1]\n"
+"\n"
+"  -i INTERVAL   Refresh interval in seconds (default: 1)\n"
+"  -n ROWS       Number of DSQ and cgroup rows to show (default: 16)\n"
+"  -1            Print one snapshot and exit\n"
+"  -h            Display this help and exit\n";
+
+/* userspace mirrors of the SCX_DSQ_* IDs in include/linux/sched/ext.h */
+#define TOP_DSQ_INVALID		(1LLU << 63)
+#define TOP_DSQ_GLOBAL		(TOP_DSQ_INVALID | 1)
+
+struct top_dsq_row {
+	u64			id;
+	struct top_dsq_stat	st;
+};
+
+struct top_cgrp_row {
+	u64			id;
+	struct top_cgrp_stat	st;
+};
+
+static volatile int exit_req;
+
+static void sigint_handler(int dummy)
+{
+	exit_req = 1;
+}
+
+static int cmp_dsq_row(const void *a, const void *b)
+{
+	const struct top_dsq_row *ra = a, *rb = b;
+
+	if (ra->st.nr != rb->st.nr)
+		return ra->st.nr < rb->st.nr ? 1 : -1;
+	return (rb->st.head_age_ms > ra->st.head_age_ms) -
+	       (rb->st.head_age_ms < ra->st.head_age_ms);
+}
+
+static int cmp_cgrp_row(const void *a, const void *b)
+{
+	const struct top_cgrp_row *ra = a, *rb = b;
+
+	if (ra->st.max_delay_ms != rb->st.max_delay_ms)
+		return ra->st.max_delay_ms < rb->st.max_delay_ms ? 1 : -1;
+	return (rb->st.nr > ra->st.nr) - (rb->st.nr < ra->st.nr);
+}
+
+static int run_iter(struct bpf_link *link)
+{
+	char buf[64];
+	int fd;
+
+	fd = bpf_iter_create(bpf_link__fd(link));
+	if (fd < 0)
+		return fd;
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+	close(fd);
+	return 0;
+}
+
+static int read_dsqs(int map_fd, u64 gen, struct top_dsq_row *rows)
+{
+	u64 key, *prev = NULL;
+	int nr = 0;
+
+	while (nr < TOP_MAX_DSQS && !bpf_map_get_next_key(map_fd, prev, &key)) {
+		prev = &key;
+		if (bpf_map_lookup_elem(map_fd, &key, &rows[nr].st) ||
+		    rows[nr].st.gen != gen)
+			continue;
+		rows[nr++].id = key;
+	}
+	return nr;
+}
+
+static int read_cgrps(int map_fd, u64 gen, struct top_cgrp_row *rows)
+{
+	u64 key, *prev = NULL;
+	int nr = 0;
+
+	while (nr < TOP_MAX_CGRPS && !bpf_map_get_next_key(map_fd, prev, &key)) {
+		prev = &key;
+		if (bpf_map_lookup_elem(map_fd, &key, &rows[nr].st) ||
+		    rows[nr].st.gen != gen)
+			continue;
+		rows[nr++].id = key;
+	}
+	return nr;
+}
+
+static void print_dsq_id(u64 id)
+{
+	if (id == TOP_DSQ_INVALID)
+		printf("%-20s", "bpf");
+	else if (id == TOP_DSQ_GLOBAL)
+		printf("%-20s", "global");
+	else
+		printf("%-20llu", (unsigned long long)id);
+}
+
+int main(int argc, char **argv)
+{
+	static struct top_dsq_row dsqs[TOP_MAX_DSQS];
+	static struct top_cgrp_row cgrps[TOP_MAX_CGRPS];
+	const volatile struct top_cpu_stat *cpus;
+	struct timespec intv_ts = { .tv_sec = 1, .tv_nsec = 0 };
+	struct scx_top *skel;
+	struct bpf_link *dsq_link, *task_link;
+	bool once = false;
+	int nr_cpus, rows = 16, opt;
+	size_t cpus_sz;
+	u64 gen = 0;
+
+	signal(SIGINT, sigint_handler);
+	signal(SIGTERM, sigint_handler);
+
+	libbpf_set_strict_mode(LIBBPF_STRICT_ALL);
+
+	while ((opt = getopt(argc, argv, "i:n:1h")) != -1) {
+		double v;
+
+		switch (opt) {
+		case 'i':
+			v = strtod(optarg, NULL);
+			intv_ts.tv_sec = v;
+			intv_ts.tv_nsec = (v - (float)intv_ts.tv_sec) * 1000000000;
+			break;
+		case 'n':
+			rows = strtoul(optarg, NULL, 0);
+			break;
+		case '1':
+			once = true;
+			break;
+		default:
+			fprintf(stderr, help_fmt, basename(argv[0]));
+			return opt != 'h';
+		}
+	}
+
+	skel = scx_top__open();
+	if (!skel) {
+		fprintf(stderr, "Failed to open: %s\n", strerror(errno));
+		return 1;
+	}
+
+	nr_cpus = libbpf_num_possible_cpus();
+	skel->rodata->nr_cpus = nr_cpus;
+	bpf_map__set_max_entries(skel->maps.cpu_stats, nr_cpus);
+
+	if (scx_top__load(skel)) {
+		fprintf(stderr, "Failed to load: %s\n", strerror(errno));
+		return 1;
+	}
+
+	cpus_sz = sizeof(struct top_cpu_stat) * nr_cpus;
+	cpus = mmap(NULL, cpus_sz, PROT_READ, MAP_SHARED,
+		    bpf_map__fd(skel->maps.cpu_stats), 0);
+	if (cpus == MAP_FAILED) {
+		fprintf(stderr, "Failed to mmap cpu_stats: %s\n", strerror(errno));
+		return 1;
+	}
+
+	dsq_link = bpf_program__attach_iter(skel->progs.scx_top_dsq_iter, NULL);
+	task_link = bpf_program__attach_iter(skel->progs.scx_top_task_iter, NULL);
+	if (!dsq_link || !task_link) {
+		fprintf(stderr, "Failed to attach iter: %s\n", strerror(errno));
+		return 1;
+	}
+
+	while (!exit_req) {
+		u32 nr_idle = 0, nr_idle_starved = 0, nr_shared_queued = 0;
+		int i, nr_dsqs, nr_cgrps;
+
+		skel->bss->gen = ++gen;
+		if (run_iter(dsq_link) || run_iter(task_link)) {
+			fprintf(stderr, "Failed to run iter: %s\n", strerror(errno));
+			break;
+		}
+
+		nr_dsqs = read_dsqs(bpf_map__fd(skel->maps.dsq_stats), gen, dsqs);
+		nr_cgrps = read_cgrps(bpf_map__fd(skel->maps.cgrp_stats), gen, cgrps);
+		qsort(dsqs, nr_dsqs, sizeof(dsqs[0]), cmp_dsq_row);
+		qsort(cgrps, nr_cgrps, sizeof(cgrps[0]), cmp_cgrp_row);
+
+		/* tasks which any idle CPU could have picked up */
+		for (i = 0; i < nr_dsqs; i++)
+			if (dsqs[i].id != TOP_DSQ_INVALID)
+				nr_shared_queued += dsqs[i].st.nr;
+
+		if (!once)
+			printf("\033[H\033[2J");
+
+		printf("CPUS (i: idle, l: local DSQ depth, r: SCX tasks on rq)\n");
+		for (i = 0; i < nr_cpus; i++) {
+			const volatile struct top_cpu_stat *cs = &cpus[i];
+
+			if (cs->idle) {
+				nr_idle++;
+				if (!cs->local_nr && nr_shared_queued)
+					nr_idle_starved++;
+			}
+			printf("%4d%s l=%-3u r=%-3u%s", i, cs->idle ? "i" : " ",
+			       cs->local_nr, cs->nr_running,
+			       (i + 1) % 6 && i + 1 < nr_cpus ? "  " : "\n");
+		}
+
+		printf("\nidle=%u shared_queued=%u idle_while_queued=%u%s\n",
+		       nr_idle, nr_shared_queued, nr_idle_starved,
+		       nr_idle_starved ? "  <-- idle CPUs not being fed" : "");
+
+		printf("\n%-20s %8s %14s\n", "DSQ", "queued", "head_wait_ms");
+		for (i = 0; i < nr_dsqs && i < rows; i++) {
+			print_dsq_id(dsqs[i].id);
+			printf(" %8u %14llu\n", dsqs[i].st.nr,
+			       (unsigned long long)dsqs[i].st.head_age_ms);
+		}
+
+		printf("\n%-20s %8s %14s %14s\n",
+		       "CGROUP", "queued", "avg_delay_ms", "max_delay_ms");
+		for (i = 0; i < nr_cgrps && i < rows; i++)
+			printf("%-20llu %8u %14llu %14llu\n",
+			       (unsigned long long)cgrps[i].id, cgrps[i].st.nr,
+			       (unsigned long long)(cgrps[i].st.sum_delay_ms /
+						    cgrps[i].st.nr),
+			       (unsigned long long)cgrps[i].st.max_delay_ms);
+
+		fflush(stdout);
+		if (once)
+			break;
+		nanosleep(&intv_ts, NULL);
+	}
+
+	bpf_link__destroy(task_link);
+	bpf_link__destroy(dsq_link);
+	munmap((void *)cpus, cpus_sz);
+	scx_top__destroy(skel);
+	return 0;
+}
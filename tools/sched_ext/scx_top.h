@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Definitions shared between scx_top.bpf.c and scx_top.c.
+ *
+ * Copyright (c) 2023 Meta Platforms, Inc. and affiliates.
+ */
+#ifndef __SCX_TOP_H
+#define __SCX_TOP_H
+
+enum {
+	TOP_MAX_DSQS		= 1024,
+	TOP_MAX_CGRPS		= 4096,
+};
+
+struct top_cpu_stat {
+	u64			gen;
+	u32			local_nr;	/* tasks on the local DSQ */
+	u32			nr_running;	/* SCX tasks on the rq */
+	u32			idle;		/* running the idle task */
+};
+
+struct top_dsq_stat {
+	u64			gen;
+	u32			nr;		/* queued tasks */
+	u64			head_age_ms;	/* how long the head task waited */
+};
+
+struct top_cgrp_stat {
+	u64			gen;
+	u32			nr;		/* queued tasks seen */
+	u64			sum_delay_ms;	/* sum of the queued tasks' delay */
+	u64			max_delay_ms;	/* longest queued task delay */
+};
+
+#endif /* __SCX_TOP_H */
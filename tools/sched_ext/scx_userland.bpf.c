@@ -9,6 +9,11 @@
  * 2. A primitive vruntime scheduler that is implemented in user space, for all
  *    other tasks.
  *
+ * Per-task state lives in task_table, an mmap-able array map indexed by pid
+ * which the user space scheduler maps and accesses directly. The BPF side
+ * updates a task's runtime and weight in place on enqueue and only passes the
+ * pid to user space, which keeps its vruntime in the same entry.
+ *
  * Some parts of this example user space scheduler could be implemented more
  * efficiently using more complex and sophisticated data structures. For
  * example, rather than using BPF_MAP_TYPE_QUEUE's,
@@ -20,8 +25,8 @@
  * Copyright (c) 2022 Tejun Heo <tj@kernel.org>
  * Copyright (c) 2022 David Vernet <dvernet@meta.com>
  */
-#include <string.h>
 #include "scx_common.bpf.h"
+#include "scx_stats.h"
 #include "scx_userland.h"
 
 char _license[] SEC("license") = "GPL";
@@ -32,9 +37,6 @@ const volatile s32 usersched_pid;
 /* !0 for veristat, set during init */
 const volatile u32 num_possible_cpus = 64;
 
-/* Stats that are printed by user space. */
-u64 nr_failed_enqueues, nr_kernel_enqueues, nr_user_enqueues;
-
 struct user_exit_info uei;
 
 /*
@@ -44,14 +46,28 @@ struct user_exit_info uei;
 static bool usersched_needed;
 
 /*
- * The map containing tasks that are enqueued in user space from the kernel.
+ * Per-task state shared with the user space scheduler, see struct
+ * scx_userland_task.
+ */
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__uint(max_entries, USERLAND_MAX_TASKS);
+	__type(key, u32);
+	__type(value, struct scx_userland_task);
+} task_table SEC(".maps");
+
+/*
+ * The map containing the pids of tasks that are enqueued in user space from
+ * the kernel.
  *
  * This map is drained by the user space scheduler.
  */
 struct {
 	__uint(type, BPF_MAP_TYPE_QUEUE);
+	__uint(map_flags, BPF_F_QUEUE_MPMC);
 	__uint(max_entries, USERLAND_MAX_TASKS);
-	__type(value, struct scx_userland_enqueued_task);
+	__type(value, s32);
 } enqueued SEC(".maps");
 
 /*
@@ -61,23 +77,16 @@ struct {
  */
 struct {
 	__uint(type, BPF_MAP_TYPE_QUEUE);
+	__uint(map_flags, BPF_F_QUEUE_MPMC);
 	__uint(max_entries, USERLAND_MAX_TASKS);
 	__type(value, s32);
 } dispatched SEC(".maps");
 
-/* Per-task scheduling context */
+/* Per-task scheduling context, lives in p->scx.sched_data */
 struct task_ctx {
 	bool force_local; /* Dispatch directly to local DSQ */
 };
 
-/* Map that contains task-local storage. */
-struct {
-	__uint(type, BPF_MAP_TYPE_TASK_STORAGE);
-	__uint(map_flags, BPF_F_NO_PREALLOC);
-	__type(key, int);
-	__type(value, struct task_ctx);
-} task_ctx_stor SEC(".maps");
-
 static bool is_usersched_task(const struct task_struct *p)
 {
 	return p->pid == usersched_pid;
@@ -108,13 +117,7 @@ s32 BPF_STRUCT_OPS(userland_select_cpu, struct task_struct *p,
 {
 	if (keep_in_kernel(p)) {
 		s32 cpu;
-		struct task_ctx *tctx;
-
-		tctx = bpf_task_storage_get(&task_ctx_stor, p, 0, 0);
-		if (!tctx) {
-			scx_bpf_error("Failed to look up task-local storage for %s", p->comm);
-			return -ESRCH;
-		}
+		struct task_ctx *tctx = scx_task_data(p, struct task_ctx);
 
 		if (p->nr_cpus_allowed == 1 ||
 		    scx_bpf_test_and_clear_cpu_idle(prev_cpu)) {
@@ -146,22 +149,24 @@ static void dispatch_user_scheduler(void)
 
 static void enqueue_task_in_user_space(struct task_struct *p, u64 enq_flags)
 {
-	struct scx_userland_enqueued_task task;
+	struct scx_userland_task *task;
+	s32 pid = p->pid;
 
-	memset(&task, 0, sizeof(task));
-	task.pid = p->pid;
-	task.sum_exec_runtime = p->se.sum_exec_runtime;
-	task.weight = p->scx.weight;
+	task = bpf_map_lookup_elem(&task_table, &pid);
+	if (task) {
+		task->sum_exec_runtime = p->se.sum_exec_runtime;
+		task->weight = p->scx.weight;
+	}
 
-	if (bpf_map_push_elem(&enqueued, &task, 0)) {
+	if (!task || bpf_map_push_elem(&enqueued, &pid, 0)) {
 		/*
-		 * If we fail to enqueue the task in user space, put it
-		 * directly on the global DSQ.
+		 * If the pid doesn't fit in task_table or we fail to enqueue
+		 * the task in user space, put it directly on the global DSQ.
 		 */
-		__sync_fetch_and_add(&nr_failed_enqueues, 1);
+		scx_stat_inc(USERLAND_STAT_FAILED_ENQ);
 		scx_bpf_dispatch(p, SCX_DSQ_GLOBAL, SCX_SLICE_DFL, enq_flags);
 	} else {
-		__sync_fetch_and_add(&nr_user_enqueues, 1);
+		scx_stat_inc(USERLAND_STAT_USER_ENQ);
 		usersched_needed = true;
 	}
 }
@@ -170,19 +175,13 @@ void BPF_STRUCT_OPS(userland_enqueue, struct task_struct *p, u64 enq_flags)
 {
 	if (keep_in_kernel(p)) {
 		u64 dsq_id = SCX_DSQ_GLOBAL;
-		struct task_ctx *tctx;
-
-		tctx = bpf_task_storage_get(&task_ctx_stor, p, 0, 0);
-		if (!tctx) {
-			scx_bpf_error("Failed to lookup task ctx for %s", p->comm);
-			return;
-		}
+		struct task_ctx *tctx = scx_task_data(p, struct task_ctx);
 
 		if (tctx->force_local)
 			dsq_id = SCX_DSQ_LOCAL;
 		tctx->force_local = false;
 		scx_bpf_dispatch(p, dsq_id, SCX_SLICE_DFL, enq_flags);
-		__sync_fetch_and_add(&nr_kernel_enqueues, 1);
+		scx_stat_inc(USERLAND_STAT_KERNEL_ENQ);
 		return;
 	} else if (!is_usersched_task(p)) {
 		enqueue_task_in_user_space(p, enq_flags);
@@ -215,16 +214,6 @@ void BPF_STRUCT_OPS(userland_dispatch, s32 cpu, struct task_struct *prev)
 	}
 }
 
-s32 BPF_STRUCT_OPS(userland_prep_enable, struct task_struct *p,
-		   struct scx_enable_args *args)
-{
-	if (bpf_task_storage_get(&task_ctx_stor, p, 0,
-				 BPF_LOCAL_STORAGE_GET_F_CREATE))
-		return 0;
-	else
-		return -ENOMEM;
-}
-
 s32 BPF_STRUCT_OPS(userland_init)
 {
 	if (num_possible_cpus == 0) {
@@ -254,7 +243,6 @@ struct sched_ext_ops userland_ops = {
 	.select_cpu		= (void *)userland_select_cpu,
 	.enqueue		= (void *)userland_enqueue,
 	.dispatch		= (void *)userland_dispatch,
-	.prep_enable		= (void *)userland_prep_enable,
 	.init			= (void *)userland_init,
 	.exit			= (void *)userland_exit,
 	.timeout_ms		= 3000,
@@ -29,6 +29,7 @@
 #include <sys/syscall.h>
 
 #include "user_exit_info.h"
+#include "scx_stats.h"
 #include "scx_userland.h"
 #include "scx_userland.skel.h"
 
@@ -37,10 +38,11 @@ const char help_fmt[] =
 "\n"
 "See the top-level comment in .bpf.c for more details.\n"
 "\n"
-"Usage: %s [-b BATCH] [-p]\n"
+"Usage: %s [-b BATCH] [-p] [-S]\n"
 "\n"
 "  -b BATCH      The number of tasks to batch when dispatching (default: 8)\n"
 "  -p            Don't switch all, switch only tasks on SCHED_EXT policy\n"
+"  -S            Print statistics in the machine-readable scx_stats format\n"
 "  -h            Display this help and exit\n";
 
 /* Defined in UAPI */
@@ -58,11 +60,29 @@ static struct bpf_link *ops_link;
 /* Stats collected in user space. */
 static __u64 nr_vruntime_enqueues, nr_vruntime_dispatches;
 
-/* The data structure containing tasks that are enqueued in user space. */
+/* Stats collected by the BPF scheduler. */
+static struct scx_stats stats;
+static bool print_scx_stats;
+
+static const char * const userland_stat_names[USERLAND_NR_STATS] = {
+	[USERLAND_STAT_KERNEL_ENQ]	= "kernel_enqueues",
+	[USERLAND_STAT_USER_ENQ]	= "user_enqueues",
+	[USERLAND_STAT_FAILED_ENQ]	= "failed_enqueues",
+};
+
+/*
+ * Per-task state shared with the BPF side, mmap'd from the task_table map and
+ * indexed by pid. See struct scx_userland_task.
+ */
+static struct scx_userland_task *task_table;
+static size_t task_table_sz;
+
+/*
+ * The data structure containing tasks that are enqueued in user space. The
+ * scheduling state of the task lives in the matching task_table entry.
+ */
 struct enqueued_task {
 	LIST_ENTRY(enqueued_task) entries;
-	__u64 sum_exec_runtime;
-	double vruntime;
 };
 
 /*
@@ -89,7 +109,7 @@ static struct listhead vruntime_head = LIST_HEAD_INITIALIZER(vruntime_head);
  */
 struct enqueued_task tasks[USERLAND_MAX_TASKS];
 
-static double min_vruntime;
+static __u64 min_vruntime;
 
 static void sigint_handler(int userland)
 {
@@ -118,41 +138,45 @@ static int dispatch_task(s32 pid)
 
 static struct enqueued_task *get_enqueued_task(__s32 pid)
 {
-	if (pid >= USERLAND_MAX_TASKS)
+	if (pid < 0 || pid >= USERLAND_MAX_TASKS)
 		return NULL;
 
 	return &tasks[pid];
 }
 
-static double calc_vruntime_delta(__u64 weight, __u64 delta)
+static __u64 task_vruntime(const struct enqueued_task *enqueued)
 {
-	double weight_f = (double)weight / 100.0;
-	double delta_f = (double)delta;
+	return task_table[task_pid(enqueued)].vruntime;
+}
 
-	return delta_f / weight_f;
+static __u64 calc_vruntime_delta(__u64 weight, __u64 delta)
+{
+	return weight ? delta * 100 / weight : delta;
 }
 
-static void update_enqueued(struct enqueued_task *enqueued, const struct scx_userland_enqueued_task *bpf_task)
+static void update_enqueued(struct scx_userland_task *task)
 {
 	__u64 delta;
 
-	delta = bpf_task->sum_exec_runtime - enqueued->sum_exec_runtime;
+	delta = task->sum_exec_runtime - task->charged_runtime;
 
-	enqueued->vruntime += calc_vruntime_delta(bpf_task->weight, delta);
-	if (min_vruntime > enqueued->vruntime)
-		enqueued->vruntime = min_vruntime;
-	enqueued->sum_exec_runtime = bpf_task->sum_exec_runtime;
+	task->vruntime += calc_vruntime_delta(task->weight, delta);
+	if (min_vruntime > task->vruntime)
+		task->vruntime = min_vruntime;
+	task->charged_runtime = task->sum_exec_runtime;
 }
 
-static int vruntime_enqueue(const struct scx_userland_enqueued_task *bpf_task)
+static int vruntime_enqueue(__s32 pid)
 {
 	struct enqueued_task *curr, *enqueued, *prev;
+	__u64 vruntime;
 
-	curr = get_enqueued_task(bpf_task->pid);
+	curr = get_enqueued_task(pid);
 	if (!curr)
 		return ENOENT;
 
-	update_enqueued(curr, bpf_task);
+	update_enqueued(&task_table[pid]);
+	vruntime = task_table[pid].vruntime;
 	nr_vruntime_enqueues++;
 
 	/*
@@ -169,7 +193,7 @@ static int vruntime_enqueue(const struct scx_userland_enqueued_task *bpf_task)
 	}
 
 	LIST_FOREACH(enqueued, &vruntime_head, entries) {
-		if (curr->vruntime <= enqueued->vruntime) {
+		if (vruntime <= task_vruntime(enqueued)) {
 			LIST_INSERT_BEFORE(enqueued, curr, entries);
 			return 0;
 		}
@@ -184,16 +208,16 @@ static int vruntime_enqueue(const struct scx_userland_enqueued_task *bpf_task)
 static void drain_enqueued_map(void)
 {
 	while (1) {
-		struct scx_userland_enqueued_task task;
+		__s32 pid;
 		int err;
 
-		if (bpf_map_lookup_and_delete_elem(enqueued_fd, NULL, &task))
+		if (bpf_map_lookup_and_delete_elem(enqueued_fd, NULL, &pid))
 			return;
 
-		err = vruntime_enqueue(&task);
+		err = vruntime_enqueue(pid);
 		if (err) {
 			fprintf(stderr, "Failed to enqueue task %d: %s\n",
-				task.pid, strerror(err));
+				pid, strerror(err));
 			exit_req = 1;
 			return;
 		}
@@ -213,7 +237,7 @@ static void dispatch_batch(void)
 		if (!task)
 			return;
 
-		min_vruntime = task->vruntime;
+		min_vruntime = task_vruntime(task);
 		pid = task_pid(task);
 		LIST_REMOVE(task, entries);
 		err = dispatch_task(pid);
@@ -228,11 +252,20 @@ static void dispatch_batch(void)
 static void *run_stats_printer(void *arg)
 {
 	while (!exit_req) {
+		__u64 cnts[USERLAND_NR_STATS];
 		__u64 nr_failed_enqueues, nr_kernel_enqueues, nr_user_enqueues, total;
 
-		nr_failed_enqueues = skel->bss->nr_failed_enqueues;
-		nr_kernel_enqueues = skel->bss->nr_kernel_enqueues;
-		nr_user_enqueues = skel->bss->nr_user_enqueues;
+		scx_stats_read(&stats, cnts);
+
+		if (print_scx_stats) {
+			scx_stats_print(&stats, cnts, "userland", stdout);
+			sleep(1);
+			continue;
+		}
+
+		nr_failed_enqueues = cnts[USERLAND_STAT_FAILED_ENQ];
+		nr_kernel_enqueues = cnts[USERLAND_STAT_KERNEL_ENQ];
+		nr_user_enqueues = cnts[USERLAND_STAT_USER_ENQ];
 		total = nr_failed_enqueues + nr_kernel_enqueues + nr_user_enqueues;
 
 		printf("o-----------------------o\n");
@@ -290,7 +323,7 @@ static int bootstrap(int argc, char **argv)
 		return err;
 	}
 
-	while ((opt = getopt(argc, argv, "b:ph")) != -1) {
+	while ((opt = getopt(argc, argv, "b:pSh")) != -1) {
 		switch (opt) {
 		case 'b':
 			batch_size = strtoul(optarg, NULL, 0);
@@ -298,6 +331,9 @@ static int bootstrap(int argc, char **argv)
 		case 'p':
 			switch_partial = true;
 			break;
+		case 'S':
+			print_scx_stats = true;
+			break;
 		default:
 			fprintf(stderr, help_fmt, basename(argv[0]));
 			exit(opt != 'h');
@@ -327,12 +363,34 @@ static int bootstrap(int argc, char **argv)
 	assert(skel->rodata->usersched_pid > 0);
 	skel->rodata->switch_partial = switch_partial;
 
+	err = scx_stats_init(&stats, skel->maps.scx_stats, userland_stat_names,
+			     USERLAND_NR_STATS);
+	if (err) {
+		fprintf(stderr, "Failed to init stats: %s\n", strerror(-err));
+		goto destroy_skel;
+	}
+
 	err = scx_userland__load(skel);
 	if (err) {
 		fprintf(stderr, "Failed to load scheduler: %s\n", strerror(err));
 		goto destroy_skel;
 	}
 
+	err = scx_stats_mmap(&stats);
+	if (err) {
+		fprintf(stderr, "Failed to mmap stats: %s\n", strerror(-err));
+		goto destroy_skel;
+	}
+
+	task_table_sz = sizeof(*task_table) * USERLAND_MAX_TASKS;
+	task_table = mmap(NULL, task_table_sz, PROT_READ | PROT_WRITE,
+			  MAP_SHARED, bpf_map__fd(skel->maps.task_table), 0);
+	if (task_table == MAP_FAILED) {
+		fprintf(stderr, "Failed to mmap task table: %s\n", strerror(errno));
+		err = errno;
+		goto destroy_skel;
+	}
+
 	enqueued_fd = bpf_map__fd(skel->maps.enqueued);
 	dispatched_fd = bpf_map__fd(skel->maps.dispatched);
 	assert(enqueued_fd > 0);
@@ -397,6 +455,7 @@ int main(int argc, char **argv)
 	exit_req = 1;
 	bpf_link__destroy(ops_link);
 	uei_print(&skel->bss->uei);
+	munmap(task_table, task_table_sz);
 	scx_userland__destroy(skel);
 	return 0;
 }
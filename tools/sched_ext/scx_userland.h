@@ -6,14 +6,27 @@
 
 #define USERLAND_MAX_TASKS 8192
 
+enum userland_stat_idx {
+	USERLAND_STAT_KERNEL_ENQ,
+	USERLAND_STAT_USER_ENQ,
+	USERLAND_STAT_FAILED_ENQ,
+
+	USERLAND_NR_STATS,
+};
+
 /*
- * An instance of a task that has been enqueued by the kernel for consumption
- * by a user space global scheduler thread.
+ * Per-task scheduling state in the task_table map, indexed by pid. The map is
+ * mmap'd by the user space scheduler so that both sides read and write the
+ * entries in place. The kernel only passes pids through the enqueued queue.
  */
-struct scx_userland_enqueued_task {
-	__s32 pid;
-	u64 sum_exec_runtime;
-	u64 weight;
+struct scx_userland_task {
+	/* updated by BPF before the pid is pushed to the enqueued queue */
+	__u64 sum_exec_runtime;
+	__u64 weight;
+
+	/* owned by the user space scheduler */
+	__u64 charged_runtime;	/* sum_exec_runtime already charged */
+	__u64 vruntime;
 };
 
 #endif  // __SCX_USERLAND_COMMON_H
@@ -14,6 +14,8 @@ static const char * const cpumask_success_testcases[] = {
 	"test_and_or_xor",
 	"test_intersects_subset",
 	"test_copy_any_anyand",
+	"test_iter_cpumask",
+	"test_iter_cpumask_release",
 	"test_insert_leave",
 	"test_insert_remove_release",
 	"test_global_mask_rcu",
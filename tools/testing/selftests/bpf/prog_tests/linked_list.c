@@ -152,6 +152,28 @@ enum {
 	LIST_IN_LIST,
 };
 
+/* BPF_F_LOCK is rejected for per-CPU values, see array_map_update_elem() */
+static void test_percpu_map_f_lock(const struct bpf_map *map)
+{
+	int key = 0, nr_cpus, ret;
+	void *values;
+
+	nr_cpus = libbpf_num_possible_cpus();
+	if (!ASSERT_GT(nr_cpus, 0, "libbpf_num_possible_cpus"))
+		return;
+
+	values = calloc(nr_cpus, roundup(bpf_map__value_size(map), 8));
+	if (!ASSERT_OK_PTR(values, "calloc values"))
+		return;
+
+	ret = bpf_map_lookup_elem_flags(bpf_map__fd(map), &key, values, BPF_F_LOCK);
+	ASSERT_EQ(ret, -EINVAL, "percpu lookup BPF_F_LOCK");
+	ret = bpf_map_update_elem(bpf_map__fd(map), &key, values, BPF_F_LOCK);
+	ASSERT_EQ(ret, -EINVAL, "percpu update BPF_F_LOCK");
+
+	free(values);
+}
+
 static void test_linked_list_success(int mode, bool leave_in_map)
 {
 	LIBBPF_OPTS(bpf_test_run_opts, opts,
@@ -183,6 +205,16 @@ static void test_linked_list_success(int mode, bool leave_in_map)
 	if (!leave_in_map)
 		clear_fields(skel->maps.inner_map);
 
+	/* elements left in the per-CPU map are freed on destruction */
+	ret = bpf_prog_test_run_opts(bpf_program__fd(skel->progs.percpu_map_list_push_pop), &opts);
+	ASSERT_OK(ret, "percpu_map_list_push_pop");
+	ASSERT_OK(opts.retval, "percpu_map_list_push_pop retval");
+
+	ret = bpf_prog_test_run_opts(bpf_program__fd(skel->progs.percpu_map_update_f_lock), &opts);
+	ASSERT_OK(ret, "percpu_map_update_f_lock");
+	ASSERT_OK(opts.retval, "percpu_map_update_f_lock retval");
+	test_percpu_map_f_lock(skel->maps.percpu_array_map);
+
 	ret = bpf_prog_test_run_opts(bpf_program__fd(skel->progs.global_list_push_pop), &opts);
 	ASSERT_OK(ret, "global_list_push_pop");
 	ASSERT_OK(opts.retval, "global_list_push_pop retval");
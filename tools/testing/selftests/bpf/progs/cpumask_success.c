@@ -350,6 +350,83 @@ int BPF_PROG(test_copy_any_anyand, struct task_struct *task, u64 clone_flags)
 	return 0;
 }
 
+SEC("tp_btf/task_newtask")
+int BPF_PROG(test_iter_cpumask, struct task_struct *task, u64 clone_flags)
+{
+	struct bpf_iter_cpumask it;
+	struct bpf_cpumask *cpumask;
+	int *cpu, nr_iters = 0;
+	u32 last = nr_cpus - 1;
+
+	if (!is_test_task())
+		return 0;
+
+	cpumask = create_cpumask();
+	if (!cpumask)
+		return 0;
+
+	bpf_cpumask_set_cpu(0, cpumask);
+	bpf_cpumask_set_cpu(last, cpumask);
+
+	bpf_iter_cpumask_new(&it, cast(cpumask));
+	while ((cpu = bpf_iter_cpumask_next(&it))) {
+		if ((nr_iters == 0 && *cpu != 0) ||
+		    (nr_iters == 1 && *cpu != last) || nr_iters > 1) {
+			err = 3;
+			break;
+		}
+		nr_iters++;
+	}
+	bpf_iter_cpumask_destroy(&it);
+
+	if (!err && nr_iters != (last ? 2 : 1))
+		err = 4;
+
+	bpf_cpumask_release(cpumask);
+	return 0;
+}
+
+SEC("tp_btf/task_newtask")
+int BPF_PROG(test_iter_cpumask_release, struct task_struct *task, u64 clone_flags)
+{
+	struct bpf_iter_cpumask it;
+	struct bpf_cpumask *cpumask;
+	int *cpu, nr_iters = 0;
+	u32 last = nr_cpus - 1;
+
+	if (!is_test_task())
+		return 0;
+
+	cpumask = create_cpumask();
+	if (!cpumask)
+		return 0;
+
+	bpf_cpumask_set_cpu(0, cpumask);
+	bpf_cpumask_set_cpu(last, cpumask);
+
+	bpf_iter_cpumask_new(&it, cast(cpumask));
+	cpu = bpf_iter_cpumask_next(&it);
+
+	/* the iterator owns a copy, releasing the mask mid-iteration is fine */
+	bpf_cpumask_release(cpumask);
+
+	while (cpu) {
+		if ((nr_iters == 0 && *cpu != 0) ||
+		    (nr_iters == 1 && *cpu != last) || nr_iters > 1) {
+			err = 3;
+			break;
+		}
+		nr_iters++;
+		cpu = bpf_iter_cpumask_next(&it);
+	}
+	bpf_iter_cpumask_destroy(&it);
+
+	if (!err && nr_iters != (last ? 2 : 1))
+		err = 4;
+
+	return 0;
+}
+
 SEC("tp_btf/task_newtask")
 int BPF_PROG(test_insert_leave, struct task_struct *task, u64 clone_flags)
 {
@@ -1,4 +1,5 @@
 // SPDX-License-Identifier: GPL-2.0
+#include <linux/errno.h>
 #include <vmlinux.h>
 #include <bpf/bpf_tracing.h>
 #include <bpf/bpf_helpers.h>
@@ -303,6 +304,28 @@ int inner_map_list_push_pop(void *ctx)
 	return test_list_push_pop(&v->lock, &v->head);
 }
 
+SEC("tc")
+int percpu_map_list_push_pop(void *ctx)
+{
+	struct map_value *v;
+
+	v = bpf_map_lookup_percpu_elem(&percpu_array_map, &(int){0}, 0);
+	if (!v)
+		return 1;
+	return test_list_push_pop(&v->lock, &v->head);
+}
+
+SEC("tc")
+int percpu_map_update_f_lock(void *ctx)
+{
+	struct map_value v = {};
+
+	/* per-CPU values can't be updated under their locks */
+	if (bpf_map_update_elem(&percpu_array_map, &(int){0}, &v, BPF_F_LOCK) != -EINVAL)
+		return 1;
+	return 0;
+}
+
 SEC("tc")
 int global_list_push_pop(void *ctx)
 {
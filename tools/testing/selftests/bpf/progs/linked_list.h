@@ -35,6 +35,14 @@ struct array_map {
 struct array_map array_map SEC(".maps");
 struct array_map inner_map SEC(".maps");
 
+/* one lock and list per CPU */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, int);
+	__type(value, struct map_value);
+	__uint(max_entries, 1);
+} percpu_array_map SEC(".maps");
+
 struct {
 	__uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
 	__uint(max_entries, 1);
@@ -592,6 +592,66 @@ static void test_queuemap(unsigned int task, void *data)
 	close(fd);
 }
 
+static void test_queuemap_mpmc(unsigned int task, void *data)
+{
+	const int MAP_SIZE = 32;
+	__u32 vals[MAP_SIZE], val;
+	int fd, i;
+
+	for (i = 0; i < MAP_SIZE; i++)
+		vals[i] = rand();
+
+	/* Only queue maps can be MPMC */
+	map_opts.map_flags |= BPF_F_QUEUE_MPMC;
+	fd = bpf_map_create(BPF_MAP_TYPE_STACK, NULL, 0, sizeof(val), MAP_SIZE, &map_opts);
+	assert(fd < 0 && errno == EINVAL);
+
+	fd = bpf_map_create(BPF_MAP_TYPE_QUEUE, NULL, 0, sizeof(val), MAP_SIZE, &map_opts);
+	map_opts.map_flags &= ~BPF_F_QUEUE_MPMC;
+	/* Queue map does not support BPF_F_NO_PREALLOC */
+	if (map_opts.map_flags & BPF_F_NO_PREALLOC) {
+		assert(fd < 0 && errno == EINVAL);
+		return;
+	}
+	if (fd < 0) {
+		printf("Failed to create MPMC queuemap '%s'!\n", strerror(errno));
+		exit(1);
+	}
+
+	/* Push MAP_SIZE elements */
+	for (i = 0; i < MAP_SIZE; i++)
+		assert(bpf_map_update_elem(fd, NULL, &vals[i], 0) == 0);
+
+	/* Check that element cannot be pushed due to max_entries limit */
+	assert(bpf_map_update_elem(fd, NULL, &val, 0) < 0 &&
+	       errno == E2BIG);
+
+	/* Overwriting the oldest element is not supported */
+	assert(bpf_map_update_elem(fd, NULL, &val, BPF_EXIST) < 0 &&
+	       errno == EINVAL);
+
+	/* Peek element */
+	assert(bpf_map_lookup_elem(fd, NULL, &val) == 0 && val == vals[0]);
+
+	/* Pop all elements */
+	for (i = 0; i < MAP_SIZE; i++)
+		assert(bpf_map_lookup_and_delete_elem(fd, NULL, &val) == 0 &&
+		       val == vals[i]);
+
+	/* Check that there are not elements left */
+	assert(bpf_map_lookup_and_delete_elem(fd, NULL, &val) < 0 &&
+	       errno == ENOENT);
+
+	/* Wrap around */
+	for (i = 0; i < MAP_SIZE / 2; i++)
+		assert(bpf_map_update_elem(fd, NULL, &vals[i], 0) == 0);
+	for (i = 0; i < MAP_SIZE / 2; i++)
+		assert(bpf_map_lookup_and_delete_elem(fd, NULL, &val) == 0 &&
+		       val == vals[i]);
+
+	close(fd);
+}
+
 static void test_stackmap(unsigned int task, void *data)
 {
 	const int MAP_SIZE = 32;
@@ -1898,6 +1958,7 @@ static void run_all_tests(void)
 	test_reuseport_array();
 
 	test_queuemap(0, NULL);
+	test_queuemap_mpmc(0, NULL);
 	test_stackmap(0, NULL);
 
 	test_map_in_map();